@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# benchmarks ls over a set of synthetic trees.
+#
+#	bench.sh [-s]
+#
+# the trees are generated under $BENCH_DIR the first time, then every flag
+# combination is timed on each of them, with a warm cache and, where the
+# cache can be dropped, a cold one. results go to bench/results.txt and are
+# compared against bench/baseline.txt if there is one. with -s, the results
+# are saved as the new baseline instead.
+#
+# BENCH_SIZES	sizes of the flat directories (default 1000 10000 100000 1000000)
+# BENCH_RUNS	runs per measurement, the median is reported (default 5)
+# BENCH_DIR	where the trees are generated (default /tmp/ls-bench)
+
+set -e
+
+BENCHDIR=$(cd "$(dirname "$0")" && pwd)
+LS=${LS:-$BENCHDIR/../ls}
+GENTREE=$BENCHDIR/gentree
+BENCHRUN=$BENCHDIR/benchrun
+RESULTS=$BENCHDIR/results.txt
+BASELINE=$BENCHDIR/baseline.txt
+
+BENCH_SIZES=${BENCH_SIZES:-"1000 10000 100000 1000000"}
+BENCH_RUNS=${BENCH_RUNS:-5}
+BENCH_DIR=${BENCH_DIR:-/tmp/ls-bench}
+
+FLAGS="-f -l -lR -S -t -lh -s"
+
+save=0
+if [ "$1" = "-s" ]; then
+	save=1
+fi
+
+# generates a tree unless it already exists
+gen() {
+	name=$1
+	shift
+	if [ ! -d "$BENCH_DIR/$name" ]; then
+		echo "generating $name" >&2
+		"$GENTREE" "$@" "$BENCH_DIR/$name"
+	fi
+	TREES="$TREES $name"
+}
+
+# drops the file system caches, returns 1 if that is not possible here
+drop_caches() {
+	if [ -w /proc/sys/vm/drop_caches ]; then
+		sync
+		echo 3 > /proc/sys/vm/drop_caches
+		return 0
+	fi
+	return 1
+}
+
+# counts the system calls of a single run, or prints - without a tracer
+count_syscalls() {
+	trace=$BENCH_DIR/trace.out
+	if command -v ktrace > /dev/null 2>&1; then
+		ktrace -i -t c -f "$trace" "$@" > /dev/null 2>&1
+		kdump -f "$trace" | grep -c ' CALL '
+	elif command -v strace > /dev/null 2>&1; then
+		strace -f -c -o "$trace" "$@" > /dev/null 2>&1
+		awk '$NF == "total" { print $(NF - 1) }' "$trace"
+	else
+		echo -
+	fi
+	rm -f "$trace"
+}
+
+mkdir -p "$BENCH_DIR"
+
+TREES=
+for n in $BENCH_SIZES; do
+	gen "flat$n" -n "$n"
+done
+gen deep -D 12 -W 2 -n 20
+gen wide -D 2 -W 100 -n 50
+gen symlinks -n 100000 -L 50
+gen owners -n 100000 -O 500
+
+: > "$RESULTS"
+printf '%-14s %-5s %-5s %9s %9s %9s %9s %9s\n' tree flags cache wall user \
+    sys maxrss syscalls
+for tree in $TREES; do
+	for flags in $FLAGS; do
+		for cache in warm cold; do
+			if [ $cache = cold ]; then
+				drop_caches || continue
+				runs=1
+			else
+				# one run to warm the cache up
+				"$LS" $flags "$BENCH_DIR/$tree" > /dev/null
+				runs=$BENCH_RUNS
+			fi
+			set -- $("$BENCHRUN" -n $runs -- "$LS" $flags \
+			    "$BENCH_DIR/$tree")
+			calls=$(count_syscalls "$LS" $flags "$BENCH_DIR/$tree")
+			printf '%-14s %-5s %-5s %9s %9s %9s %9s %9s\n' $tree \
+			    $flags $cache $1 $2 $3 $4 $calls | tee -a "$RESULTS"
+		done
+	done
+done
+
+if [ $save = 1 ]; then
+	cp "$RESULTS" "$BASELINE"
+	echo "saved as baseline"
+elif [ -f "$BASELINE" ]; then
+	echo
+	echo "compared to the baseline (new / old):"
+	printf '%-14s %-5s %-5s %9s %9s %9s\n' tree flags cache wall maxrss \
+	    syscalls
+	awk 'NR == FNR { wall[$1 " " $2 " " $3] = $4
+			rss[$1 " " $2 " " $3] = $7
+			calls[$1 " " $2 " " $3] = $8
+			next }
+	    function ratio(new, old) {
+		if (old == "-" || new == "-" || old == 0)
+			return "-"
+		return sprintf("%.2f", new / old)
+	    }
+	    ($1 " " $2 " " $3) in wall {
+		k = $1 " " $2 " " $3
+		printf "%-14s %-5s %-5s %9s %9s %9s\n", $1, $2, $3,
+		    ratio($4, wall[k]), ratio($7, rss[k]),
+		    ratio($8, calls[k])
+	    }' "$BASELINE" "$RESULTS"
+fi
@@ -0,0 +1,113 @@
+/*
+ * runs a command several times with its output discarded, and reports the
+ * median wall clock, user and system time and the largest peak RSS.
+ *
+ *	benchrun [-n runs] -- command [arg ...]
+ *
+ * prints a single line: wall user sys (in seconds) and maxrss (in KB).
+ */
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_RUNS 100
+
+static int
+cmp_double(const void *p1, const void *p2)
+{
+    double d1 = *(const double *)p1, d2 = *(const double *)p2;
+
+    return (d1 > d2) - (d1 < d2);
+}
+
+static double
+tv_secs(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *end;
+    double wall[MAX_RUNS], user[MAX_RUNS], sys[MAX_RUNS];
+    int ch, i, runs = 5, status, fd;
+    long maxrss = 0;
+    pid_t pid;
+    struct rusage ru;
+    struct timeval start, stop;
+
+    while ((ch = getopt(argc, argv, "n:")) != -1) {
+        switch (ch) {
+        case 'n':
+            runs = (int)strtol(optarg, &end, 10);
+            if (*end != '\0' || runs < 1 || runs > MAX_RUNS) {
+                (void)fprintf(stderr, "benchrun: invalid runs: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            (void)fprintf(stderr, "usage: benchrun [-n runs] -- command "
+                "[arg ...]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1) {
+        (void)fprintf(stderr, "usage: benchrun [-n runs] -- command "
+            "[arg ...]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < runs; i++) {
+        (void)gettimeofday(&start, NULL);
+        if ((pid = fork()) < 0) {
+            (void)fprintf(stderr, "benchrun: fork: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+                (void)dup2(fd, STDOUT_FILENO);
+            }
+            (void)execvp(argv[0], argv);
+            (void)fprintf(stderr, "benchrun: %s: %s\n", argv[0],
+                strerror(errno));
+            _exit(127);
+        }
+        if (wait4(pid, &status, 0, &ru) < 0) {
+            (void)fprintf(stderr, "benchrun: wait4: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        (void)gettimeofday(&stop, NULL);
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            (void)fprintf(stderr, "benchrun: %s failed\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        wall[i] = tv_secs(&stop) - tv_secs(&start);
+        user[i] = tv_secs(&ru.ru_utime);
+        sys[i] = tv_secs(&ru.ru_stime);
+        if (ru.ru_maxrss > maxrss) {
+            maxrss = ru.ru_maxrss;
+        }
+    }
+
+    qsort(wall, runs, sizeof(*wall), cmp_double);
+    qsort(user, runs, sizeof(*user), cmp_double);
+    qsort(sys, runs, sizeof(*sys), cmp_double);
+
+    (void)printf("%.4f %.4f %.4f %ld\n", wall[runs / 2], user[runs / 2],
+        sys[runs / 2], maxrss);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * generates a synthetic directory tree for the benchmarks.
+ *
+ *	gentree [-D depth] [-W width] [-n files] [-L percent] [-O owners] dir
+ *
+ * every directory of the tree gets files regular files, of which percent
+ * are replaced by symbolic links. below the top, every directory has width
+ * subdirectories down to depth levels, depth 0 being a single flat
+ * directory. files get varied sizes and times so -S and -t have something
+ * to sort by, and are handed out to owners different uids when run as root.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* first uid handed out with -O */
+#define FIRST_UID 10000
+
+static long nfiles = 1000, percent = 0, owners = 0;
+static int depth = 0, width = 0;
+static unsigned long seed = 1;
+
+static void
+usage(void)
+{
+    (void)fprintf(stderr, "usage: gentree [-D depth] [-W width] [-n files] "
+        "[-L percent] [-O owners] dir\n");
+    exit(EXIT_FAILURE);
+}
+
+static void
+fail(const char *what, const char *path)
+{
+    (void)fprintf(stderr, "gentree: %s: %s: %s\n", what, path,
+        strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+/* a small deterministic generator, so trees are the same from run to run */
+static unsigned long
+next_rand(void)
+{
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 16) & 0x7fffffffUL;
+}
+
+static long
+parse_num(const char *arg)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || errno != 0 || n < 0) {
+        (void)fprintf(stderr, "gentree: invalid number: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+static void
+make_files(const char *dir)
+{
+    char path[4096];
+    int fd;
+    long i;
+    struct timeval tv[2];
+
+    for (i = 0; i < nfiles; i++) {
+        (void)snprintf(path, sizeof(path), "%s/file%08ld", dir, i);
+
+        if ((long)(next_rand() % 100) < percent) {
+            if (symlink("target", path) < 0 && errno != EEXIST) {
+                fail("symlink", path);
+            }
+            continue;
+        }
+
+        if ((fd = open(path, O_WRONLY | O_CREAT, 0644)) < 0) {
+            fail("open", path);
+        }
+        /* sparse, so even huge trees take next to no space */
+        if (ftruncate(fd, (off_t)(next_rand() % (1024 * 1024))) < 0) {
+            fail("ftruncate", path);
+        }
+        if (owners > 0 && fchown(fd, FIRST_UID + next_rand() % owners,
+            FIRST_UID + next_rand() % owners) < 0 && errno != EPERM) {
+            fail("fchown", path);
+        }
+        (void)close(fd);
+
+        /* spread over the last two years, across the six month boundary */
+        (void)gettimeofday(&tv[0], NULL);
+        tv[0].tv_sec -= next_rand() % (2 * 365 * 24 * 60 * 60);
+        tv[0].tv_usec = next_rand() % 1000000;
+        tv[1] = tv[0];
+        if (utimes(path, tv) < 0) {
+            fail("utimes", path);
+        }
+    }
+}
+
+static void
+make_tree(const char *dir, int level)
+{
+    char path[4096];
+    int i;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fail("mkdir", dir);
+    }
+    make_files(dir);
+
+    if (level >= depth) {
+        return;
+    }
+    for (i = 0; i < width; i++) {
+        (void)snprintf(path, sizeof(path), "%s/dir%04d", dir, i);
+        make_tree(path, level + 1);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+
+    while ((ch = getopt(argc, argv, "D:L:n:O:W:")) != -1) {
+        switch (ch) {
+        case 'D':
+            depth = (int)parse_num(optarg);
+            break;
+        case 'L':
+            percent = parse_num(optarg);
+            break;
+        case 'n':
+            nfiles = parse_num(optarg);
+            break;
+        case 'O':
+            owners = parse_num(optarg);
+            break;
+        case 'W':
+            width = (int)parse_num(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+        usage();
+    }
+
+    make_tree(argv[0], 0);
+    return 0;
+}
@@ -0,0 +1,592 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "dirlist.h"
+#include "flags.h"
+#include "stats.h"
+#include "utils.h"
+
+#define CACHE_MAGIC "lscache1"
+
+/* the flags which decide what a directory's list holds, a cache made with
+ * other ones is started over. none is made under FLAG_match, whose
+ * patterns it would have to hold too */
+#define CACHE_FLAGS (FLAG_A | FLAG_a | FLAG_c | FLAG_f | FLAG_h | FLAG_u \
+    | FLAGS_STAT | FLAG_match)
+
+/* initial number of slots in the table, always a power of two */
+#define CACHE_INIT_SZ 256
+
+/* records are padded to a multiple of this, so every field of a mapped
+ * file is aligned */
+#define CACHE_ALIGN 8
+#define ALIGN(n) (((n) + CACHE_ALIGN - 1) & ~(size_t)(CACHE_ALIGN - 1))
+
+/*
+ * the cache file is this header followed by a record per directory. the
+ * fields have fixed widths in the native byte order, so the file can be
+ * used in place once mapped. a file of another layout has another entsz.
+ */
+struct cachehdr {
+    char magic[8];
+    unsigned int flags;
+    unsigned int entsz;
+    unsigned long long ndirs;
+};
+
+/*
+ * the record of a directory: this, an entry for each of its children and
+ * their names, NUL terminated and packed one after the other. size is the
+ * length of all of it, padding included. meta is set if the entries hold
+ * their metadata rather than only their type.
+ */
+struct cachedir {
+    unsigned long long dev, ino;
+    long long mtime, mtimensec, ctime, ctimensec;
+    unsigned long long nents;
+    unsigned long long size;
+    unsigned long long meta;
+};
+
+/*
+ * a child of a directory record. only the fields the flags need are set,
+ * sec and nsec hold the one time they select, like struct dirmeta. name is
+ * the offset of its name among the names of the record.
+ */
+struct cacheent {
+    unsigned long long ino, nlink, rdev, size, blocks;
+    long long sec, nsec;
+    unsigned int mode, uid, gid, name, type;
+};
+
+/*
+ * a slot of the table of directories. a record read from the cache file
+ * points into the mapping, fresh ones were made during this run. a stale
+ * record is no longer used, but keeps its slot until it is replaced.
+ */
+struct cacheslot {
+    unsigned long long dev, ino;
+    struct cachedir *dir;
+    int fresh;
+    int stale;
+};
+
+/* set by --cache, and to CACHE_STRICT by --cache-strict */
+int cache_mode;
+
+static char *cache_path;
+static unsigned int cache_flags;
+static int list_flags;
+
+static void *map;
+static size_t mapsz;
+
+static struct cacheslot *slots;
+static size_t nslots, count;
+
+/* the table is shared by every thread of a parallel traversal */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t
+hash_dir(unsigned long long dev, unsigned long long ino, size_t size)
+{
+    return (size_t)((ino * 0x9e3779b97f4a7c15ULL ^ dev) & (size - 1));
+}
+
+static struct cacheslot *
+find_slot(struct cacheslot *table, size_t size, unsigned long long dev,
+    unsigned long long ino)
+{
+    size_t i = hash_dir(dev, ino, size);
+
+    while (table[i].dir != NULL
+        && (table[i].dev != dev || table[i].ino != ino)) {
+        i = (i + 1) & (size - 1);
+    }
+    return &table[i];
+}
+
+static void
+grow_table(void)
+{
+    struct cacheslot *table, *slot;
+    size_t i, size = nslots ? nslots * 2 : CACHE_INIT_SZ;
+
+    if ((table = calloc(size, sizeof(*table))) == NULL) {
+        (void)fprintf(stderr, "ls: calloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].dir != NULL) {
+            slot = find_slot(table, size, slots[i].dev, slots[i].ino);
+            *slot = slots[i];
+        }
+    }
+
+    free(slots);
+    slots = table;
+    nslots = size;
+}
+
+/*
+ * adds the record of a directory to the table, in place of any record of
+ * the same directory.
+ */
+static void
+insert_dir(struct cachedir *dir, int fresh)
+{
+    struct cacheslot *slot;
+
+    /* keep the load factor at or below one half */
+    if ((count + 1) * 2 > nslots) {
+        grow_table();
+    }
+
+    slot = find_slot(slots, nslots, dir->dev, dir->ino);
+    if (slot->dir == NULL) {
+        count++;
+    } else if (slot->fresh) {
+        free(slot->dir);
+    }
+    slot->dev = dir->dev;
+    slot->ino = dir->ino;
+    slot->dir = dir;
+    slot->fresh = fresh;
+    slot->stale = 0;
+}
+
+/*
+ * returns the record of the directory stamp is for if its times are still
+ * the same, NULL otherwise.
+ */
+static const struct cachedir *
+find_dir(const struct dirstamp *stamp)
+{
+    const struct cacheslot *slot;
+    const struct cachedir *dir;
+
+    if (nslots == 0) {
+        return NULL;
+    }
+    slot = find_slot(slots, nslots, (unsigned long long)stamp->dev,
+        (unsigned long long)stamp->ino);
+    dir = slot->dir;
+
+    if (dir == NULL || slot->stale || dir->mtime != (long long)stamp->mtime
+        || dir->mtimensec != stamp->mtimensec
+        || dir->ctime != (long long)stamp->ctime
+        || dir->ctimensec != stamp->ctimensec) {
+        return NULL;
+    }
+    return dir;
+}
+
+/*
+ * checks that a record of the mapped file fits in the room left and that
+ * all of its names are within it and terminated.
+ */
+static int
+valid_dir(const struct cachedir *dir, size_t room)
+{
+    const struct cacheent *ents = (const struct cacheent *)(dir + 1);
+    size_t i, namesz;
+
+    if (dir->size > room || dir->size < sizeof(*dir)
+        || dir->size % CACHE_ALIGN != 0
+        || dir->nents > (dir->size - sizeof(*dir)) / sizeof(*ents)) {
+        return 0;
+    }
+
+    namesz = dir->size - sizeof(*dir) - dir->nents * sizeof(*ents);
+    if (dir->nents > 0 && (namesz == 0
+        || ((const char *)dir)[dir->size - 1] != '\0')) {
+        return 0;
+    }
+    for (i = 0; i < dir->nents; i++) {
+        if (ents[i].name >= namesz) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * puts every record of the mapped file in the table. returns -1 if the
+ * file is not a cache made with the current flags.
+ */
+static int
+load_map(void)
+{
+    const struct cachehdr *hdr = map;
+    char *p = (char *)map + sizeof(*hdr), *end = (char *)map + mapsz;
+    struct cachedir *dir;
+    unsigned long long i;
+
+    if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->entsz != sizeof(struct cacheent)
+        || hdr->flags != cache_flags) {
+        return -1;
+    }
+
+    for (i = 0; i < hdr->ndirs; i++) {
+        dir = (struct cachedir *)p;
+        if ((size_t)(end - p) < sizeof(*dir)
+            || !valid_dir(dir, (size_t)(end - p))) {
+            return -1;
+        }
+        insert_dir(dir, 0);
+        p += dir->size;
+    }
+    return 0;
+}
+
+/*
+ * turns on the cache kept in the file at path, for listings made with the
+ * given flags. under strict, every directory is still read and its entries
+ * fetched, and those found to differ from the cache are reported. a cache
+ * which is missing, unreadable or made with other flags is started over.
+ * if path is NULL, the cache is only kept in memory.
+ */
+void
+cache_open(const char *path, int flags, int strict)
+{
+    int fd;
+    struct stat sb;
+
+    cache_mode = strict ? CACHE_STRICT : CACHE_ON;
+    cache_flags = flags & CACHE_FLAGS;
+    list_flags = flags;
+    if (path == NULL) {
+        return;
+    }
+    if ((cache_path = strdup(path)) == NULL) {
+        (void)fprintf(stderr, "ls: strdup: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return;
+    }
+    if (fstat(fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(struct cachehdr)) {
+        map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+        } else {
+            mapsz = (size_t)sb.st_size;
+        }
+    }
+    (void)close(fd);
+
+    if (map != NULL && load_map() < 0) {
+        free(slots);
+        slots = NULL;
+        nslots = count = 0;
+    }
+}
+
+/*
+ * stops using the cache if listings made with the given flags would differ
+ * from the ones it holds.
+ */
+void
+cache_match(int flags)
+{
+    if ((flags & CACHE_FLAGS) != cache_flags) {
+        cache_mode = CACHE_OFF;
+    }
+}
+
+/*
+ * fills in stamp for the directory open as fd. returns 0 on success and -1
+ * with errno set on failure.
+ */
+int
+cache_stamp(int fd, struct dirstamp *stamp)
+{
+    int rv;
+    struct stat sb;
+    struct timespec start;
+
+    STATS_START(start);
+    rv = fstat(fd, &sb);
+    STATS_CALL(CALL_STAT, start);
+    if (rv < 0) {
+        return -1;
+    }
+
+    stamp->dev = sb.st_dev;
+    stamp->ino = sb.st_ino;
+    stamp->mtime = sb.st_mtime;
+    stamp->mtimensec = ST_MTIMENSEC(&sb);
+    stamp->ctime = sb.st_ctime;
+    stamp->ctimensec = ST_CTIMENSEC(&sb);
+    return 0;
+}
+
+/*
+ * fills the empty list with the entries cached for the directory stamp is
+ * for, in the order they were read. returns -1 if the cache has none or
+ * the directory has changed since.
+ */
+int
+cache_get(const struct dirstamp *stamp, struct dirlist *list)
+{
+    const struct cachedir *dir;
+    const struct cacheent *ent;
+    const char *names;
+    size_t i;
+    struct stat sb;
+
+    (void)pthread_mutex_lock(&cache_lock);
+    if ((dir = find_dir(stamp)) == NULL) {
+        (void)pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+
+    ent = (const struct cacheent *)(dir + 1);
+    names = (const char *)(ent + dir->nents);
+    for (i = 0; i < dir->nents; i++) {
+        push_dirname(list, names + ent[i].name, (unsigned char)ent[i].type);
+    }
+
+    if (dir->meta) {
+        alloc_meta(list, list_flags);
+        for (i = 0; i < dir->nents; i++, ent++) {
+            memset(&sb, 0, sizeof(sb));
+            sb.st_mode = ent->mode;
+            sb.st_ino = ent->ino;
+            sb.st_nlink = ent->nlink;
+            sb.st_uid = ent->uid;
+            sb.st_gid = ent->gid;
+            sb.st_rdev = ent->rdev;
+            sb.st_size = ent->size;
+            sb.st_blocks = ent->blocks;
+            /* set_meta() keeps whichever of them the flags select */
+            sb.st_atime = sb.st_mtime = sb.st_ctime = ent->sec;
+            ST_ATIMENSEC(&sb) = ST_MTIMENSEC(&sb) = ent->nsec;
+            ST_CTIMENSEC(&sb) = ent->nsec;
+            set_meta(list, i, &sb);
+        }
+    }
+    (void)pthread_mutex_unlock(&cache_lock);
+
+    return 0;
+}
+
+/*
+ * makes the record of the entries of list, in the order they are in.
+ */
+static struct cachedir *
+make_dir(const struct dirstamp *stamp, const struct dirlist *list)
+{
+    const struct dirmeta *meta = &list->meta;
+    struct cachedir *dir;
+    struct cacheent *ent;
+    char *names;
+    size_t i, j, len, namesz = 0, size;
+
+    for (i = 0; i < list->nents; i++) {
+        namesz += strlen(list->ents[i].name) + 1;
+    }
+    size = ALIGN(sizeof(*dir) + list->nents * sizeof(*ent) + namesz);
+
+    /* zeroed, so records of the same entries are the same bytes */
+    if ((dir = calloc(1, size)) == NULL) {
+        (void)fprintf(stderr, "ls: calloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    dir->dev = (unsigned long long)stamp->dev;
+    dir->ino = (unsigned long long)stamp->ino;
+    dir->mtime = (long long)stamp->mtime;
+    dir->mtimensec = stamp->mtimensec;
+    dir->ctime = (long long)stamp->ctime;
+    dir->ctimensec = stamp->ctimensec;
+    dir->nents = list->nents;
+    dir->size = size;
+    dir->meta = meta->mode != NULL;
+
+    ent = (struct cacheent *)(dir + 1);
+    names = (char *)(ent + list->nents);
+    for (i = namesz = 0; i < list->nents; i++, ent++) {
+        len = strlen(list->ents[i].name) + 1;
+        memcpy(names + namesz, list->ents[i].name, len);
+        ent->name = (unsigned int)namesz;
+        ent->type = list->ents[i].type;
+        namesz += len;
+
+        if (meta->mode == NULL) {
+            continue;
+        }
+        j = list->ents[i].idx;
+        ent->mode = meta->mode[j];
+        if (meta->ino != NULL) {
+            ent->ino = meta->ino[j];
+        }
+        if (meta->nlink != NULL) {
+            ent->nlink = meta->nlink[j];
+            ent->uid = meta->uid[j];
+            ent->gid = meta->gid[j];
+            ent->rdev = meta->rdev[j];
+        }
+        if (meta->size != NULL) {
+            ent->size = meta->size[j];
+        }
+        if (meta->blocks != NULL) {
+            ent->blocks = meta->blocks[j];
+        }
+        if (meta->sec != NULL) {
+            ent->sec = meta->sec[j];
+            ent->nsec = meta->nsec[j];
+        }
+    }
+    return dir;
+}
+
+/*
+ * caches the entries of list, the directory at path stamp is for, as they
+ * were read and fetched. under strict, if the cache held other entries for
+ * the directory although its times are the same, it is reported as stale.
+ */
+void
+cache_put(const struct dirstamp *stamp, const struct dirlist *list,
+    const char *path)
+{
+    const struct cachedir *old;
+    struct cachedir *dir = make_dir(stamp, list);
+
+    (void)pthread_mutex_lock(&cache_lock);
+    if (cache_mode == CACHE_STRICT && (old = find_dir(stamp)) != NULL
+        && (old->size != dir->size || memcmp(old, dir, dir->size) != 0)) {
+        (void)fprintf(stderr, "ls: %s: cached entries are stale\n", path);
+    }
+    insert_dir(dir, 1);
+    (void)pthread_mutex_unlock(&cache_lock);
+}
+
+/*
+ * stops using the entries cached for the directory dev and ino, until they
+ * are put again.
+ */
+void
+cache_drop(dev_t dev, ino_t ino)
+{
+    struct cacheslot *slot;
+
+    (void)pthread_mutex_lock(&cache_lock);
+    if (nslots > 0) {
+        slot = find_slot(slots, nslots, (unsigned long long)dev,
+            (unsigned long long)ino);
+        if (slot->dir != NULL) {
+            slot->stale = 1;
+        }
+    }
+    (void)pthread_mutex_unlock(&cache_lock);
+}
+
+/*
+ * stops using the entries cached for every directory.
+ */
+void
+cache_clear(void)
+{
+    size_t i;
+
+    (void)pthread_mutex_lock(&cache_lock);
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].dir != NULL) {
+            slots[i].stale = 1;
+        }
+    }
+    (void)pthread_mutex_unlock(&cache_lock);
+}
+
+/*
+ * writes the cache back, the directories listed during this run along with
+ * those which were not. the file is replaced at once, so a run which fails
+ * or is interrupted leaves the previous cache behind.
+ */
+void
+cache_save(void)
+{
+    FILE *fp;
+    char *tmp;
+    int failed = 0;
+    size_t i, len, ndirs = 0;
+    struct cachehdr hdr;
+
+    if (cache_path == NULL) {
+        return;
+    }
+
+    len = strlen(cache_path) + 24;
+    if ((tmp = malloc(len)) == NULL) {
+        (void)fprintf(stderr, "ls: malloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    (void)snprintf(tmp, len, "%s.%ld", cache_path, (long)getpid());
+
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        (void)fprintf(stderr, "ls: %s: %s\n", tmp, strerror(errno));
+        free(tmp);
+        return;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.flags = cache_flags;
+    hdr.entsz = sizeof(struct cacheent);
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].dir != NULL && !slots[i].stale) {
+            ndirs++;
+        }
+    }
+    hdr.ndirs = ndirs;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+        failed = 1;
+    }
+    for (i = 0; !failed && i < nslots; i++) {
+        if (slots[i].dir != NULL && !slots[i].stale
+            && fwrite(slots[i].dir, slots[i].dir->size, 1, fp) != 1) {
+            failed = 1;
+        }
+    }
+
+    if (fclose(fp) != 0 || failed || rename(tmp, cache_path) < 0) {
+        (void)fprintf(stderr, "ls: %s: %s\n", cache_path, strerror(errno));
+        (void)unlink(tmp);
+    }
+    free(tmp);
+}
+
+void
+free_cache(void)
+{
+    size_t i;
+
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].fresh) {
+            free(slots[i].dir);
+        }
+    }
+    free(slots);
+    slots = NULL;
+    nslots = count = 0;
+
+    if (map != NULL) {
+        (void)munmap(map, mapsz);
+        map = NULL;
+    }
+    free(cache_path);
+    cache_path = NULL;
+}
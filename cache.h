@@ -0,0 +1,40 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <sys/types.h>
+
+#include <time.h>
+
+#include "dirlist.h"
+
+/* what --cache and --cache-strict turn on */
+#define CACHE_OFF 0
+#define CACHE_ON 1
+#define CACHE_STRICT 2
+
+/*
+ * what a directory is known by in the cache, and the times which tell
+ * whether its entries have changed since they were cached.
+ */
+struct dirstamp {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    long mtimensec;
+    time_t ctime;
+    long ctimensec;
+};
+
+extern int cache_mode;
+
+void cache_open(const char *, int, int);
+void cache_match(int);
+int cache_stamp(int, struct dirstamp *);
+int cache_get(const struct dirstamp *, struct dirlist *);
+void cache_put(const struct dirstamp *, const struct dirlist *, const char *);
+void cache_drop(dev_t, ino_t);
+void cache_clear(void);
+void cache_save(void);
+void free_cache(void);
+
+#endif
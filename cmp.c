@@ -1,87 +1,131 @@
 #include <sys/stat.h>
 
 #include <string.h>
+#include <time.h>
 
 #include "cmp.h"
+#include "flags.h"
+#include "utils.h"
+
+/*
+ * the comparisons below work on the name and metadata of two entries, see
+ * sort_entries() for the same orders on a struct dirlist.
+ */
+static int
+cmp_size(const struct stat *sb1, const struct stat *sb2)
+{
+    if (sb1->st_size > sb2->st_size) {
+        return -1;
+    } else if (sb1->st_size < sb2->st_size) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * newest first, by the second and then the nanosecond, the same times
+ * backwards by name. the times are compared rather than subtracted, their
+ * difference need not fit in an int.
+ */
+static int
+cmp_time(time_t t1, long nsec1, const char *name1, time_t t2, long nsec2,
+    const char *name2)
+{
+    if (t1 != t2) {
+        return t1 > t2 ? -1 : 1;
+    }
+    if (nsec1 != nsec2) {
+        return nsec1 > nsec2 ? -1 : 1;
+    }
+    return strcoll(name2, name1);
+}
+
+/*
+ * returns the comparison function fts should sort entries with based on the
+ * given flags, or NULL if they should not be sorted.
+ */
+cmp_func
+get_compar(int flags)
+{
+    cmp_func compar = ascending;
+
+    if (flags & FLAG_f) {
+        compar = NULL;
+    }
+    if (flags & FLAG_S) {
+        if (flags & FLAG_r) {
+            compar = size_rev;
+        } else {
+            compar = size;
+        }
+    }
+    if (flags & FLAG_t) {
+        if (flags & FLAG_r) {
+            compar = file_mtime_rev;
+        } else {
+            compar = file_mtime;
+        }
+        if (flags & FLAG_u) {
+            if (flags & FLAG_r) {
+                compar = file_atime_rev;
+            } else {
+                compar = file_atime;
+            }
+        } else if (flags & FLAG_c) {
+            if (flags & FLAG_r) {
+                compar = file_ctime_rev;
+            } else {
+                compar = file_ctime;
+            }
+        }
+    }
+
+    return compar;
+}
 
 int
 ascending(const FTSENT **entry1, const FTSENT **entry2)
 {
-    return strcmp((*entry1)->fts_name, (*entry2)->fts_name);
+    return strcoll((*entry1)->fts_name, (*entry2)->fts_name);
 }
 
 int
 descending(const FTSENT **entry1, const FTSENT **entry2)
 {
-    return strcmp((*entry2)->fts_name, (*entry1)->fts_name);
+    return strcoll((*entry2)->fts_name, (*entry1)->fts_name);
 }
 
 int
 size(const FTSENT **entry1, const FTSENT **entry2)
 {
-    if ((*entry1)->fts_statp->st_size > (*entry2)->fts_statp->st_size) {
-        return -1;
-    } else if ((*entry1)->fts_statp->st_size < (*entry2)->fts_statp->st_size) {
-        return 1;
-    }
-    return 0; 
+    return cmp_size((*entry1)->fts_statp, (*entry2)->fts_statp);
 }
 
 int
 file_mtime(const FTSENT **entry1, const FTSENT **entry2)
 {
-    /* first check the difference in time at the second level, but if they are
-     * the same, go down to nanosecond level */
-    double diff = difftime((*entry2)->fts_statp->st_mtime, 
-        (*entry1)->fts_statp->st_mtime);
-
-    if (diff == 0) {
-        long nano_diff = (*entry2)->fts_statp->st_mtimensec 
-            - (*entry1)->fts_statp->st_mtimensec;
-        if (nano_diff == 0) {
-            return descending(entry1, entry2);
-        }
-        return nano_diff;
-    }
-    return diff;
+    const struct stat *sb1 = (*entry1)->fts_statp, *sb2 = (*entry2)->fts_statp;
+
+    return cmp_time(sb1->st_mtime, ST_MTIMENSEC(sb1), (*entry1)->fts_name,
+        sb2->st_mtime, ST_MTIMENSEC(sb2), (*entry2)->fts_name);
 }
 
 int
 file_atime(const FTSENT **entry1, const FTSENT **entry2)
 {
-    /* first check the difference in time at the second level, but if they are
-     * the same, go down to nanosecond level */
-    double diff = difftime((*entry2)->fts_statp->st_atime, 
-        (*entry1)->fts_statp->st_atime);
-
-    if (diff == 0) {
-        long nano_diff = (*entry2)->fts_statp->st_atimensec 
-            - (*entry1)->fts_statp->st_atimensec;
-        if (nano_diff == 0) {
-            return descending(entry1, entry2);
-        }
-        return nano_diff;
-    }
-    return diff;
+    const struct stat *sb1 = (*entry1)->fts_statp, *sb2 = (*entry2)->fts_statp;
+
+    return cmp_time(sb1->st_atime, ST_ATIMENSEC(sb1), (*entry1)->fts_name,
+        sb2->st_atime, ST_ATIMENSEC(sb2), (*entry2)->fts_name);
 }
 
 int
 file_ctime(const FTSENT **entry1, const FTSENT **entry2)
 {
-    /* first check the difference in time at the second level, but if they are
-     * the same, go down to nanosecond level */
-    double diff = difftime((*entry2)->fts_statp->st_ctime, 
-        (*entry1)->fts_statp->st_ctime);
-
-    if (diff == 0) {
-        long nano_diff = (*entry2)->fts_statp->st_ctimensec 
-            - (*entry1)->fts_statp->st_ctimensec;
-        if (nano_diff == 0) {
-            return descending(entry1, entry2);
-        }
-        return nano_diff;
-    }
-    return diff;
+    const struct stat *sb1 = (*entry1)->fts_statp, *sb2 = (*entry2)->fts_statp;
+
+    return cmp_time(sb1->st_ctime, ST_CTIMENSEC(sb1), (*entry1)->fts_name,
+        sb2->st_ctime, ST_CTIMENSEC(sb2), (*entry2)->fts_name);
 }
 
 int
@@ -107,4 +151,3 @@ file_ctime_rev(const FTSENT **entry1, const FTSENT **entry2)
 {
     return file_ctime(entry2, entry1);
 }
-
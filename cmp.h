@@ -5,6 +5,10 @@
 
 #include <fts.h>
 
+/* the signature fts_open(3) expects for its comparison function */
+typedef int (*cmp_func)(const FTSENT **, const FTSENT **);
+
+cmp_func get_compar(int);
 int ascending(const FTSENT **, const FTSENT **);
 int descending(const FTSENT **, const FTSENT **);
 int size(const FTSENT **, const FTSENT **);
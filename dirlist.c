@@ -0,0 +1,367 @@
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirlist.h"
+#include "flags.h"
+#include "stats.h"
+#include "utils.h"
+
+/* every thread reading directories has a buffer of its own, allocated the
+ * first time it reads one */
+static __thread char *dirbuf;
+
+static char *
+get_dirbuf(void)
+{
+    if (dirbuf == NULL && (dirbuf = malloc(DIRBUF_SZ)) == NULL) {
+        fail("malloc");
+    }
+    return dirbuf;
+}
+
+/*
+ * frees the buffer of the calling thread, before it exits.
+ */
+void
+free_dirbuf(void)
+{
+    free(dirbuf);
+    dirbuf = NULL;
+}
+
+/*
+ * copies name into the pool of list, starting a new chunk when the current
+ * one is full. returns NULL if there is no room for it.
+ */
+static char *
+pool_name(struct dirlist *list, const char *name, size_t len)
+{
+    struct namechunk *chunk;
+    char *p;
+
+    if (len > list->left) {
+        if ((chunk = malloc(sizeof(*chunk) + NAMEPOOL_SZ)) == NULL) {
+            fail("malloc");
+            return NULL;
+        }
+        chunk->prev = list->chunks;
+        list->chunks = chunk;
+        list->next = (char *)(chunk + 1);
+        list->left = NAMEPOOL_SZ;
+    }
+
+    p = list->next;
+    memcpy(p, name, len);
+    list->next += len;
+    list->left -= len;
+    return p;
+}
+
+/*
+ * appends an entry to list, copying its name. returns -1 with errno set if
+ * there is no room for it.
+ */
+int
+push_dirname(struct dirlist *list, const char *name, unsigned char type)
+{
+    struct dirname *ents;
+    size_t cap;
+    char *copy;
+
+    if (list->nents == list->cap) {
+        cap = list->cap ? list->cap * 2 : 64;
+        if ((ents = realloc(list->ents, cap * sizeof(*ents))) == NULL) {
+            fail("realloc");
+            return -1;
+        }
+        list->ents = ents;
+        list->cap = cap;
+    }
+
+    if ((copy = pool_name(list, name, strlen(name) + 1)) == NULL) {
+        return -1;
+    }
+    list->ents[list->nents].name = copy;
+    list->ents[list->nents].idx = 0;
+    list->ents[list->nents].type = type;
+    list->nents++;
+    return 0;
+}
+
+/*
+ * reads the next batch of entries of the directory open as fd, as many as a
+ * single getdents(2) call returns, in place of those list held before. the
+ * memory list takes is bounded by the size of a batch. returns the number of
+ * entries read, 0 at the end of the directory and -1 with errno set on
+ * failure.
+ */
+int
+read_dirbatch(int fd, struct dirlist *list)
+{
+    char *buf = get_dirbuf();
+    struct dirent *dp;
+    int n, off, phase;
+
+    clear_dirlist(list);
+    if (buf == NULL) {
+        return -1;
+    }
+    phase = STATS_ENTER(PHASE_READDIR);
+    STATS_COUNT(CALL_GETDENTS);
+    if ((n = getdents(fd, buf, DIRBUF_SZ)) > 0) {
+        for (off = 0; n > 0 && off < n; off += dp->d_reclen) {
+            dp = (struct dirent *)(buf + off);
+            if (push_dirname(list, dp->d_name, dp->d_type) < 0) {
+                n = -1;
+            }
+        }
+        if (n > 0) {
+            n = (int)list->nents;
+        }
+    }
+    STATS_LEAVE(phase);
+    return n;
+}
+
+/*
+ * reads every entry of the directory open as fd with getdents(2), without
+ * stat'ing any of them. the entries are kept in the order they were read.
+ * returns 0 on success and -1 with errno set on failure.
+ */
+int
+read_dirlist(int fd, struct dirlist *list)
+{
+    char *buf = get_dirbuf();
+    struct dirent *dp;
+    int n, off, phase;
+
+    if (buf == NULL) {
+        return -1;
+    }
+    phase = STATS_ENTER(PHASE_READDIR);
+    for (;;) {
+        STATS_COUNT(CALL_GETDENTS);
+        if ((n = getdents(fd, buf, DIRBUF_SZ)) <= 0) {
+            break;
+        }
+        for (off = 0; n > 0 && off < n; off += dp->d_reclen) {
+            dp = (struct dirent *)(buf + off);
+            if (push_dirname(list, dp->d_name, dp->d_type) < 0) {
+                n = -1;
+            }
+        }
+        if (n < 0) {
+            break;
+        }
+    }
+    STATS_LEAVE(phase);
+
+    return n < 0 ? -1 : 0;
+}
+
+static void *
+alloc_field(const struct dirlist *list, size_t size, int *err)
+{
+    void *p;
+
+    if ((p = malloc(list->nents * size)) == NULL) {
+        fail("malloc");
+        *err = 1;
+    }
+    return p;
+}
+
+static void
+free_meta_fields(struct dirmeta *meta)
+{
+    free(meta->mode);
+    free(meta->ino);
+    free(meta->nlink);
+    free(meta->uid);
+    free(meta->gid);
+    free(meta->rdev);
+    free(meta->size);
+    free(meta->blocks);
+    free(meta->sec);
+    free(meta->nsec);
+    free(meta->files);
+    memset(meta, 0, sizeof(*meta));
+}
+
+/*
+ * allocates the fields of metadata the given flags need for every entry of
+ * list, and points each entry at its index. returns -1, with every entry
+ * dropped, if they cannot be allocated.
+ */
+int
+alloc_meta(struct dirlist *list, int flags)
+{
+    struct dirmeta *meta = &list->meta;
+    int err = 0;
+    size_t i;
+
+    free_meta_fields(meta);
+    if (list->nents == 0) {
+        return 0;
+    }
+    meta->flags = flags;
+
+    meta->mode = alloc_field(list, sizeof(*meta->mode), &err);
+    /* --du counts hard links once, and sums both sizes and blocks */
+    if (flags & (FLAG_i | FLAG_du)) {
+        meta->ino = alloc_field(list, sizeof(*meta->ino), &err);
+    }
+    if (flags & (FLAG_l | FLAG_du)) {
+        meta->nlink = alloc_field(list, sizeof(*meta->nlink), &err);
+        meta->uid = alloc_field(list, sizeof(*meta->uid), &err);
+        meta->gid = alloc_field(list, sizeof(*meta->gid), &err);
+        meta->rdev = alloc_field(list, sizeof(*meta->rdev), &err);
+    }
+    /* -h prints sizes instead of blocks, both for -s and for the total */
+    if ((flags & (FLAG_l | FLAG_S | FLAG_du))
+        || ((flags & FLAG_s) && (flags & FLAG_h))) {
+        meta->size = alloc_field(list, sizeof(*meta->size), &err);
+    }
+    if (((flags & (FLAG_l | FLAG_s)) && !(flags & FLAG_h))
+        || (flags & FLAG_du)) {
+        meta->blocks = alloc_field(list, sizeof(*meta->blocks), &err);
+    }
+    if (flags & FLAG_du) {
+        meta->files = alloc_field(list, sizeof(*meta->files), &err);
+    }
+    if (flags & (FLAG_l | FLAG_t)) {
+        meta->sec = alloc_field(list, sizeof(*meta->sec), &err);
+        meta->nsec = alloc_field(list, sizeof(*meta->nsec), &err);
+    }
+
+    if (err) {
+        free_meta_fields(meta);
+        list->nents = 0;
+        return -1;
+    }
+
+    for (i = 0; i < list->nents; i++) {
+        list->ents[i].idx = (unsigned int)i;
+    }
+    return 0;
+}
+
+/*
+ * stores the fields of sb that list keeps at index idx.
+ */
+void
+set_meta(struct dirlist *list, size_t idx, const struct stat *sb)
+{
+    struct dirmeta *meta = &list->meta;
+
+    meta->mode[idx] = sb->st_mode;
+    if (meta->ino != NULL) {
+        meta->ino[idx] = sb->st_ino;
+    }
+    if (meta->nlink != NULL) {
+        meta->nlink[idx] = sb->st_nlink;
+        meta->uid[idx] = sb->st_uid;
+        meta->gid[idx] = sb->st_gid;
+        meta->rdev[idx] = sb->st_rdev;
+    }
+    if (meta->size != NULL) {
+        meta->size[idx] = sb->st_size;
+    }
+    if (meta->blocks != NULL) {
+        meta->blocks[idx] = sb->st_blocks;
+    }
+    if (meta->files != NULL) {
+        meta->files[idx] = 1;
+    }
+    if (meta->sec != NULL) {
+        if (meta->flags & FLAG_u) {
+            meta->sec[idx] = sb->st_atime;
+            meta->nsec[idx] = ST_ATIMENSEC(sb);
+        } else if (meta->flags & FLAG_c) {
+            meta->sec[idx] = sb->st_ctime;
+            meta->nsec[idx] = ST_CTIMENSEC(sb);
+        } else {
+            meta->sec[idx] = sb->st_mtime;
+            meta->nsec[idx] = ST_MTIMENSEC(sb);
+        }
+    }
+}
+
+/*
+ * fills in sb with the fields list keeps at index idx, the others are zero.
+ */
+void
+get_meta(const struct dirlist *list, size_t idx, struct stat *sb)
+{
+    const struct dirmeta *meta = &list->meta;
+
+    memset(sb, 0, sizeof(*sb));
+    sb->st_mode = meta->mode[idx];
+    if (meta->ino != NULL) {
+        sb->st_ino = meta->ino[idx];
+    }
+    if (meta->nlink != NULL) {
+        sb->st_nlink = meta->nlink[idx];
+        sb->st_uid = meta->uid[idx];
+        sb->st_gid = meta->gid[idx];
+        sb->st_rdev = meta->rdev[idx];
+    }
+    if (meta->size != NULL) {
+        sb->st_size = meta->size[idx];
+    }
+    if (meta->blocks != NULL) {
+        sb->st_blocks = meta->blocks[idx];
+    }
+    if (meta->sec != NULL) {
+        if (meta->flags & FLAG_u) {
+            sb->st_atime = meta->sec[idx];
+            ST_ATIMENSEC(sb) = meta->nsec[idx];
+        } else if (meta->flags & FLAG_c) {
+            sb->st_ctime = meta->sec[idx];
+            ST_CTIMENSEC(sb) = meta->nsec[idx];
+        } else {
+            sb->st_mtime = meta->sec[idx];
+            ST_MTIMENSEC(sb) = meta->nsec[idx];
+        }
+    }
+}
+
+/*
+ * drops every entry of list, but keeps the room for them and the first chunk
+ * of names for the next batch.
+ */
+void
+clear_dirlist(struct dirlist *list)
+{
+    struct namechunk *chunk;
+
+    while ((chunk = list->chunks) != NULL && chunk->prev != NULL) {
+        list->chunks = chunk->prev;
+        free(chunk);
+    }
+    if (chunk != NULL) {
+        list->next = (char *)(chunk + 1);
+        list->left = NAMEPOOL_SZ;
+    }
+    list->nents = 0;
+    free_meta_fields(&list->meta);
+}
+
+void
+free_dirlist(struct dirlist *list)
+{
+    struct namechunk *chunk;
+
+    while ((chunk = list->chunks) != NULL) {
+        list->chunks = chunk->prev;
+        free(chunk);
+    }
+    free(list->ents);
+    free_meta_fields(&list->meta);
+    memset(list, 0, sizeof(*list));
+}
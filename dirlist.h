@@ -0,0 +1,77 @@
+#ifndef _DIRLIST_H_
+#define _DIRLIST_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stddef.h>
+
+/* size of the buffer getdents(2) fills, large enough that even huge
+ * directories are read in a handful of calls */
+#define DIRBUF_SZ (1024 * 1024)
+
+/*
+ * a single directory entry, type is the d_type getdents(2) reported, which
+ * may be DT_UNKNOWN. once the metadata has been fetched, it is found at
+ * index idx of the arrays of the list's struct dirmeta.
+ */
+struct dirname {
+    char *name;
+    unsigned int idx;
+    unsigned char type;
+};
+
+/*
+ * the metadata of the entries of a directory, one array per field. only the
+ * fields the flags need are allocated, the others are NULL, and mode is
+ * NULL until the metadata has been fetched. sec and nsec hold the one time
+ * the flags select. under --du, files counts the files below a directory
+ * and the directory itself, it is 1 for anything else.
+ */
+struct dirmeta {
+    int flags;
+    mode_t *mode;
+    ino_t *ino;
+    nlink_t *nlink;
+    uid_t *uid;
+    gid_t *gid;
+    dev_t *rdev;
+    off_t *size;
+    blkcnt_t *blocks;
+    time_t *sec;
+    long *nsec;
+    unsigned long long *files;
+};
+
+/* names are copied into chunks of this size, which never move */
+#define NAMEPOOL_SZ (64 * 1024)
+
+struct namechunk {
+    struct namechunk *prev;
+};
+
+/*
+ * the entries of a directory, their names are packed into pooled chunks
+ * rather than allocated one by one.
+ */
+struct dirlist {
+    struct dirname *ents;
+    size_t nents;
+    size_t cap;
+    struct dirmeta meta;
+    struct namechunk *chunks;
+    char *next;
+    size_t left;
+};
+
+int push_dirname(struct dirlist *, const char *, unsigned char);
+int read_dirbatch(int, struct dirlist *);
+int read_dirlist(int, struct dirlist *);
+int alloc_meta(struct dirlist *, int);
+void set_meta(struct dirlist *, size_t, const struct stat *);
+void get_meta(const struct dirlist *, size_t, struct stat *);
+void clear_dirlist(struct dirlist *);
+void free_dirlist(struct dirlist *);
+void free_dirbuf(void);
+
+#endif
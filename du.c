@@ -0,0 +1,139 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "du.h"
+#include "utils.h"
+
+/* the links of a sum start out with room for this many and double */
+#define DULINK_INIT_SZ 16
+
+static int
+grow_links(struct dusum *sum, size_t n)
+{
+    struct dulink *links;
+    size_t cap = sum->cap ? sum->cap : DULINK_INIT_SZ;
+
+    while (cap - sum->nlinks < n) {
+        cap *= 2;
+    }
+    if (cap == sum->cap) {
+        return 0;
+    }
+
+    if ((links = realloc(sum->links, cap * sizeof(*links))) == NULL) {
+        fail("realloc");
+        return -1;
+    }
+    sum->links = links;
+    sum->cap = cap;
+    return 0;
+}
+
+/*
+ * adds an entry of a directory on the device dev to sum. directories have
+ * more than one link of their own, but only ever one name.
+ */
+void
+du_add(struct dusum *sum, dev_t dev, const struct stat *sb)
+{
+    struct dulink *link;
+
+    /* a file with links there is no room to keep counts once per name */
+    if (S_ISDIR(sb->st_mode) || sb->st_nlink < 2 || grow_links(sum, 1) < 0) {
+        sum->blocks += sb->st_blocks;
+        sum->size += sb->st_size;
+        sum->files++;
+        return;
+    }
+
+    link = &sum->links[sum->nlinks++];
+    link->dev = dev;
+    link->ino = sb->st_ino;
+    link->blocks = sb->st_blocks;
+    link->size = sb->st_size;
+}
+
+static int
+link_cmp(const void *p1, const void *p2)
+{
+    const struct dulink *l1 = p1, *l2 = p2;
+
+    if (l1->dev != l2->dev) {
+        return l1->dev < l2->dev ? -1 : 1;
+    }
+    if (l1->ino != l2->ino) {
+        return l1->ino < l2->ino ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * sorts the links of sum and drops the names of files already in them.
+ */
+static void
+unique_links(struct dusum *sum)
+{
+    size_t i, n;
+
+    if (sum->nlinks < 2) {
+        return;
+    }
+    qsort(sum->links, sum->nlinks, sizeof(*sum->links), link_cmp);
+    for (i = n = 1; i < sum->nlinks; i++) {
+        if (link_cmp(&sum->links[i], &sum->links[n - 1]) != 0) {
+            sum->links[n++] = sum->links[i];
+        }
+    }
+    sum->nlinks = n;
+}
+
+/*
+ * adds the subtree sum to one containing it, sum is left as it is.
+ */
+void
+du_merge(struct dusum *into, struct dusum *sum)
+{
+    into->blocks += sum->blocks;
+    into->size += sum->size;
+    into->files += sum->files;
+
+    /* the links are made unique once the whole subtree is known */
+    if (sum->nlinks > 0 && grow_links(into, sum->nlinks) == 0) {
+        memcpy(into->links + into->nlinks, sum->links,
+            sum->nlinks * sizeof(*sum->links));
+        into->nlinks += sum->nlinks;
+    }
+}
+
+/*
+ * works out what the complete subtree sum adds up to, its links are made
+ * unique on the way.
+ */
+void
+du_total(struct dusum *sum, blkcnt_t *blocks, off_t *size,
+    unsigned long long *files)
+{
+    size_t i;
+
+    unique_links(sum);
+
+    *blocks = sum->blocks;
+    *size = sum->size;
+    *files = sum->files + sum->nlinks;
+    for (i = 0; i < sum->nlinks; i++) {
+        *blocks += sum->links[i].blocks;
+        *size += sum->links[i].size;
+    }
+}
+
+void
+du_free(struct dusum *sum)
+{
+    free(sum->links);
+    memset(sum, 0, sizeof(*sum));
+}
@@ -0,0 +1,37 @@
+#ifndef _DU_H_
+#define _DU_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stddef.h>
+
+/* a file with more than one link, counted once in any subtree */
+struct dulink {
+    dev_t dev;
+    ino_t ino;
+    blkcnt_t blocks;
+    off_t size;
+};
+
+/*
+ * what a subtree adds up to under --du. files with a single link are
+ * summed up right away, the others are kept in links until the subtree
+ * is complete, so that each of them is only counted once however many of
+ * its names are in it.
+ */
+struct dusum {
+    blkcnt_t blocks;
+    off_t size;
+    unsigned long long files;
+    struct dulink *links;
+    size_t nlinks;
+    size_t cap;
+};
+
+void du_add(struct dusum *, dev_t, const struct stat *);
+void du_merge(struct dusum *, struct dusum *);
+void du_total(struct dusum *, blkcnt_t *, off_t *, unsigned long long *);
+void du_free(struct dusum *);
+
+#endif
@@ -21,6 +21,32 @@
 #define FLAG_u (1 << 17)
 #define FLAG_w (1 << 18)
 
+/* the sort keys, either of which wins over -f */
+#define FLAGS_SORT (FLAG_S | FLAG_t)
+
 #define FLAG_headers (1 << 19)
 
+/* --format, records of raw fields for other programs instead of lines */
+#define FLAG_nul (1 << 20)
+#define FLAG_json (1 << 21)
+#define FLAG_binary (1 << 22)
+
+#define FLAGS_RECORD (FLAG_nul | FLAG_json | FLAG_binary | FLAG_call)
+
+/* --top, only the first entries of each directory or under -R the tree */
+#define FLAG_top (1 << 23)
+
+/* --du, directories show what everything below them adds up to */
+#define FLAG_du (1 << 24)
+
+/* --include, --exclude or --prune, entries are picked by their names */
+#define FLAG_match (1 << 25)
+
+/* lsdir_walk(), the fields of a record are handed to a function instead */
+#define FLAG_call (1 << 26)
+
+/* flags which need the metadata of every entry listed, without any of them
+ * a listing can be produced from the directory entries alone */
+#define FLAGS_STAT (FLAG_i | FLAG_l | FLAG_s | FLAG_S | FLAG_t | FLAG_du)
+
 #endif
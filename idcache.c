@@ -0,0 +1,277 @@
+#include <errno.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "idcache.h"
+#include "stats.h"
+#include "utils.h"
+
+/* initial number of slots in a table, always a power of two */
+#define IDCACHE_INIT_SZ 64
+
+/*
+ * a single slot of the cache. name is NULL for ids which are known not to
+ * have a name (negative results).
+ */
+struct id_entry {
+    unsigned long id;
+    char *name;
+    int used;
+};
+
+/*
+ * an open addressing hash table of id -> name, if it has been preloaded from
+ * a file, ids which are not found are never looked up through NSS.
+ */
+struct id_table {
+    struct id_entry *entries;
+    size_t size;
+    size_t count;
+    int preloaded;
+};
+
+static struct id_table users, groups;
+
+/* the tables and getpwuid(3)/getgrgid(3) are shared by all threads of a
+ * parallel traversal */
+static pthread_mutex_t idcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * returns the slot id hashes to in a table of size slots, a power of two.
+ */
+static size_t
+hash_id(unsigned long id, size_t size)
+{
+    unsigned long h = (id * 2654435761UL) & 0xffffffffUL;
+
+    /* Fibonacci hashing spreads consecutive ids over the whole table, by
+     * the high bits of the 32 bit product, which every bit of id affects:
+     * scaled by size, these are the top log2(size) of them */
+    return (size_t)(((unsigned long long)h * size) >> 32);
+}
+
+static struct id_entry *
+find_slot(struct id_entry *entries, size_t size, unsigned long id)
+{
+    size_t i = hash_id(id, size);
+
+    while (entries[i].used && entries[i].id != id) {
+        i = (i + 1) & (size - 1);
+    }
+    return &entries[i];
+}
+
+static int
+grow_table(struct id_table *table)
+{
+    struct id_entry *entries, *slot;
+    size_t i, size = table->size ? table->size * 2 : IDCACHE_INIT_SZ;
+
+    if ((entries = calloc(size, sizeof(struct id_entry))) == NULL) {
+        fail("calloc");
+        return -1;
+    }
+
+    for (i = 0; i < table->size; i++) {
+        if (table->entries[i].used) {
+            slot = find_slot(entries, size, table->entries[i].id);
+            *slot = table->entries[i];
+        }
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->size = size;
+    return 0;
+}
+
+/*
+ * adds id -> name to the table unless id is already there, name may be NULL
+ * to record that the id has no name. returns the cached name, or NULL if
+ * there is no room to cache it.
+ */
+static const char *
+insert_id(struct id_table *table, unsigned long id, const char *name)
+{
+    struct id_entry *slot;
+
+    /* keep the load factor at or below one half */
+    if ((table->count + 1) * 2 > table->size && grow_table(table) < 0) {
+        return NULL;
+    }
+
+    slot = find_slot(table->entries, table->size, id);
+    if (slot->used) {
+        return slot->name;
+    }
+
+    if (name != NULL && (slot->name = strdup(name)) == NULL) {
+        fail("strdup");
+        return NULL;
+    }
+    slot->id = id;
+    slot->used = 1;
+    table->count++;
+
+    return slot->name;
+}
+
+/*
+ * looks id up in the table. returns 1 and sets *name if it is cached, and 0
+ * if it still has to be resolved.
+ */
+static int
+lookup_id(const struct id_table *table, unsigned long id, const char **name)
+{
+    const struct id_entry *slot;
+
+    if (table->size == 0) {
+        return 0;
+    }
+
+    slot = find_slot(table->entries, table->size, id);
+    if (!slot->used) {
+        return 0;
+    }
+    *name = slot->name;
+    return 1;
+}
+
+static void
+free_table(struct id_table *table)
+{
+    size_t i;
+
+    for (i = 0; i < table->size; i++) {
+        free(table->entries[i].name);
+    }
+    free(table->entries);
+    memset(table, 0, sizeof(*table));
+}
+
+/*
+ * returns the name of the given user, or NULL if it has none. each uid is
+ * only looked up once per run.
+ */
+const char *
+user_name(uid_t uid)
+{
+    const char *name;
+    struct passwd *pw;
+    struct timespec start;
+
+    (void)pthread_mutex_lock(&idcache_lock);
+    if (!lookup_id(&users, (unsigned long)uid, &name)) {
+        if (users.preloaded) {
+            pw = NULL;
+        } else {
+            STATS_START(start);
+            pw = getpwuid(uid);
+            STATS_CALL(CALL_NSS, start);
+        }
+        name = insert_id(&users, (unsigned long)uid, pw ? pw->pw_name : NULL);
+    }
+    (void)pthread_mutex_unlock(&idcache_lock);
+
+    return name;
+}
+
+/*
+ * returns the name of the given group, or NULL if it has none. each gid is
+ * only looked up once per run.
+ */
+const char *
+group_name(gid_t gid)
+{
+    const char *name;
+    struct group *gr;
+    struct timespec start;
+
+    (void)pthread_mutex_lock(&idcache_lock);
+    if (!lookup_id(&groups, (unsigned long)gid, &name)) {
+        if (groups.preloaded) {
+            gr = NULL;
+        } else {
+            STATS_START(start);
+            gr = getgrgid(gid);
+            STATS_CALL(CALL_NSS, start);
+        }
+        name = insert_id(&groups, (unsigned long)gid, gr ? gr->gr_name : NULL);
+    }
+    (void)pthread_mutex_unlock(&idcache_lock);
+
+    return name;
+}
+
+/*
+ * fills the table from a file in passwd(5) or group(5) format, both of which
+ * have the name in the first field and the numeric id in the third.
+ */
+static void
+load_table(struct id_table *table, const char *path)
+{
+    char *line = NULL, *name, *field, *end;
+    FILE *fp;
+    size_t cap = 0;
+    unsigned long id;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        (void)fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    while (getline(&line, &cap, fp) != -1) {
+        name = line;
+        if (*name == '#' || (field = strchr(name, ':')) == NULL) {
+            continue;
+        }
+        *field++ = '\0';
+
+        /* skip the password field */
+        if ((field = strchr(field, ':')) == NULL) {
+            continue;
+        }
+        field++;
+
+        errno = 0;
+        id = strtoul(field, &end, 10);
+        if (end == field || *end != ':' || errno != 0) {
+            continue;
+        }
+
+        /* like getpwuid(3), the first entry for an id wins */
+        (void)insert_id(table, id, name);
+    }
+
+    if (ferror(fp)) {
+        (void)fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    free(line);
+    (void)fclose(fp);
+    table->preloaded = 1;
+}
+
+void
+load_passwd(const char *path)
+{
+    load_table(&users, path);
+}
+
+void
+load_group(const char *path)
+{
+    load_table(&groups, path);
+}
+
+void
+free_idcache(void)
+{
+    free_table(&users);
+    free_table(&groups);
+}
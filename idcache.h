@@ -0,0 +1,12 @@
+#ifndef _IDCACHE_H_
+#define _IDCACHE_H_
+
+#include <sys/types.h>
+
+const char *user_name(uid_t);
+const char *group_name(gid_t);
+void load_passwd(const char *);
+void load_group(const char *);
+void free_idcache(void);
+
+#endif
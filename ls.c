@@ -1,26 +1,482 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <dirent.h>
+
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "cache.h"
 #include "cmp.h"
+#include "dirlist.h"
 #include "flags.h"
+#include "output.h"
+#include "parallel.h"
 #include "ls.h"
+#include "match.h"
+#include "meta.h"
 #include "print.h"
+#include "sort.h"
+#include "stats.h"
+#include "top.h"
 #include "utils.h"
 
-/* global pointers which might have to be freed during unexpected exit */
-char **dirs, **files; 
+/* the directories above the one traverse_dir() lists, to detect cycles */
+struct ancestor {
+    dev_t dev;
+    ino_t ino;
+    const struct ancestor *parent;
+};
+
+static int
+is_ancestor(const struct ancestor *a, const struct stat *sb)
+{
+    for (; a != NULL; a = a->parent) {
+        if (a->dev == sb->st_dev && a->ino == sb->st_ino) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void traverse_dir(int, const char *, int, const struct ancestor *);
+static void traverse_stream(int, const char *, int, const struct ancestor *);
+static void show_dir(int, const char *, struct dirlist *, int, blkcnt_t);
+
+/*
+ * whether every entry is listed with its whole path, and so without the
+ * headers and blank lines which set directories apart: records, and the
+ * first entries of a tree under --top -R.
+ */
+static int
+whole_paths(int flags)
+{
+    return (flags & FLAGS_RECORD) || ((flags & FLAG_top) && (flags & FLAG_R));
+}
+
+/*
+ * whether entries are listed in the order they were read: under -f, unless
+ * -S or -t still asks for an order, as get_compar() does for the operands.
+ */
+static int
+unsorted(int flags)
+{
+    return (flags & FLAG_f) && !(flags & FLAGS_SORT);
+}
+
+/*
+ * whether directories are listed a batch at a time by traverse_stream():
+ * when nothing is sorted, unless the cache needs whole directories, and
+ * always under --top, which keeps no more than it prints.
+ */
+static int
+streamed(int flags)
+{
+    return (flags & FLAG_top) || (unsorted(flags) && cache_mode == CACHE_OFF);
+}
+
+/*
+ * checks whether the entry name of the given type is listed by the flags.
+ * the type may still be DT_UNKNOWN, the patterns then go by name alone.
+ */
+int
+is_listed(const char *name, unsigned char type, int flags)
+{
+    /* "." and ".." are only listed under -a, like FTS_SEEDOT */
+    if ((!(flags & FLAG_a) && is_dots(name))
+        || (!(flags & (FLAG_A | FLAG_a)) && is_hidden(name))) {
+        return 0;
+    }
+    return !(flags & FLAG_match) || match_listed(name, type);
+}
+
+/*
+ * drops the entries of list which are not to be listed.
+ */
+static void
+filter_entries(struct dirlist *list, int flags)
+{
+    size_t i, n;
+    struct dirname *ent;
+
+    /* by name alone, before anything is fetched or descended into */
+    for (i = n = 0; i < list->nents; i++) {
+        ent = &list->ents[i];
+        if (is_listed(ent->name, ent->type, flags)) {
+            list->ents[n++] = *ent;
+        }
+    }
+    list->nents = n;
+}
+
+/*
+ * sets the type of every entry of list from its metadata, and drops those
+ * the patterns turn out not to list once it is known. returns what they
+ * add to the total, in 512 byte blocks or in bytes under -h.
+ */
+static blkcnt_t
+count_entries(struct dirlist *list, int flags)
+{
+    blkcnt_t total = 0;
+    const struct dirmeta *meta = &list->meta;
+    size_t i, n;
+    struct dirname *ent;
+
+    for (i = n = 0; i < list->nents; i++) {
+        ent = &list->ents[n];
+        *ent = list->ents[i];
+        ent->type = IFTODT(meta->mode[ent->idx]);
+        if ((flags & FLAG_match) && !match_listed(ent->name, ent->type)) {
+            continue;
+        }
+        n++;
+
+        /* the total is only printed under -l, if -h is set it is the actual
+         * size to be humanized */
+        if ((flags & FLAG_l) && (flags & FLAG_h)) {
+            total += meta->size[ent->idx];
+        } else if (flags & FLAG_l) {
+            total += meta->blocks[ent->idx];
+        }
+    }
+    list->nents = n;
+    return total;
+}
+
+/*
+ * fetches the metadata of every entry of list, the directory open as fd.
+ * returns what they add to the total.
+ */
+static blkcnt_t
+fetch_entries(int fd, struct dirlist *list, int flags)
+{
+    fetch_dirlist(fd, list);
+    return count_entries(list, flags);
+}
+
+/*
+ * prints the entries of list, the directory open as fd. entries without
+ * metadata are only stat'ed if their type is unknown or -F has to tell
+ * whether a regular file is executable.
+ */
+static void
+print_entries(int fd, const char *path, struct dirlist *list, int flags)
+{
+    int phase, rv;
+    size_t i;
+    struct dirname *ent;
+    struct stat sb;
+
+    phase = STATS_ENTER(PHASE_FORMAT);
+    for (i = 0; i < list->nents; i++) {
+        ent = &list->ents[i];
+
+        if (list->meta.mode != NULL) {
+            get_meta(list, ent->idx, &sb);
+        } else {
+            memset(&sb, 0, sizeof(sb));
+            sb.st_mode = DTTOIF(ent->type);
+            if (ent->type == DT_UNKNOWN
+                || ((flags & FLAG_F) && ent->type == DT_REG)) {
+                (void)STATS_ENTER(PHASE_STAT);
+                rv = fetch_meta(fd, ent->name, &sb);
+                STATS_LEAVE(PHASE_FORMAT);
+                if (rv < 0) {
+                    (void)fprintf(stderr, "ls: %s: %s\n", ent->name,
+                        strerror(errno));
+                    continue;
+                }
+                ent->type = IFTODT(sb.st_mode);
+                if ((flags & FLAG_match)
+                    && !match_listed(ent->name, ent->type)) {
+                    continue;
+                }
+            }
+        }
+
+        if (flags & FLAG_top) {
+            top_offer(path, ent->name, &sb);
+        } else if (flags & FLAG_du) {
+            print_subtree(fd, ent->name, path, &sb,
+                list->meta.files[ent->idx]);
+        } else {
+            print_file(fd, ent->name, path, &sb);
+        }
+    }
+    STATS_LEAVE(phase);
+}
+
+/*
+ * lists every directory of list, the directory open as fd, under -R. it
+ * stops at a directory there is no room to make the path of.
+ */
+static void
+descend(int fd, const char *path, const struct dirlist *list, int flags,
+    const struct ancestor *parent)
+{
+    char *subpath;
+    int rv, subfd;
+    size_t i;
+    struct ancestor self;
+    struct dirname *ent;
+    struct stat sb;
+    struct timespec start;
+
+    STATS_START(start);
+    rv = fstat(fd, &sb);
+    STATS_CALL(CALL_STAT, start);
+    if (rv < 0) {
+        return;
+    }
+    self.dev = sb.st_dev;
+    self.ino = sb.st_ino;
+    self.parent = parent;
+
+    for (i = 0; i < list->nents; i++) {
+        ent = &list->ents[i];
+        if (ent->type != DT_DIR || is_dots(ent->name)
+            || ((flags & FLAG_match) && match_pruned(ent->name))) {
+            continue;
+        }
+
+        if ((subpath = make_path(path, ent->name)) == NULL) {
+            break;
+        }
+        STATS_COUNT(CALL_OPEN);
+        subfd = openat(fd, ent->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+
+        if (subfd >= 0) {
+            STATS_START(start);
+            rv = fstat(subfd, &sb);
+            STATS_CALL(CALL_STAT, start);
+        }
+
+        /* like fts(3), never descend into a directory above this one */
+        if (subfd >= 0 && (rv < 0 || is_ancestor(&self, &sb))) {
+            (void)close(subfd);
+            free(subpath);
+            continue;
+        }
+
+        if (!whole_paths(flags)) {
+            out_endline();
+            out_str(subpath);
+            out_char(':');
+            out_endline();
+        }
+
+        if (subfd < 0) {
+            (void)fprintf(stderr, "ls: %s: %s\n", subpath, strerror(errno));
+        } else if (streamed(flags)) {
+            traverse_stream(subfd, subpath, flags, &self);
+        } else {
+            traverse_dir(subfd, subpath, flags, &self);
+        }
+        free(subpath);
+    }
+}
+
+/*
+ * reads the entries of the directory open as fd into list, in the order
+ * they were read, and sets total to what they add up to under -l. the
+ * names and types come straight from getdents(2). only when a flag needs
+ * the metadata of every entry is each one fetched with fetch_meta(). with
+ * --cache, the entries of a directory whose times have not changed since
+ * they were cached are neither read nor fetched. returns -1 if the
+ * directory cannot be read.
+ */
+int
+load_dir(int fd, const char *path, struct dirlist *list, int flags,
+    blkcnt_t *total)
+{
+    int stamped = 0;
+    size_t nents;
+    struct dirstamp stamp;
+
+    *total = 0;
+
+    /* the stamp is taken before the directory is read, so a change made
+     * while it is read shows in its times the next time around */
+    if (cache_mode != CACHE_OFF) {
+        stamped = cache_stamp(fd, &stamp) == 0;
+    }
+
+    if (stamped && cache_mode == CACHE_ON && cache_get(&stamp, list) == 0) {
+        if (flags & FLAGS_STAT) {
+            *total = count_entries(list, flags);
+        }
+    } else {
+        if (read_dirlist(fd, list) < 0) {
+            (void)fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        filter_entries(list, flags);
+        nents = list->nents;
+
+        /* the order and the total may depend on the metadata, so it is
+         * fetched for the whole directory up front */
+        if (flags & FLAGS_STAT) {
+            *total = fetch_entries(fd, list, flags);
+        }
+
+        /* a directory with entries which could not be fetched is not
+         * cached, so their errors are reported again */
+        if (stamped && list->nents == nents) {
+            cache_put(&stamp, list, path);
+        }
+    }
+    return 0;
+}
+
+/*
+ * lists the directory open as fd into the current output sink, its total
+ * under -l and its entries in the order the flags ask for. entries without
+ * metadata are only stat'ed if their type is unknown or -F has to tell
+ * whether a regular file is executable. the entries listed are left in
+ * list for the caller to descend into. returns -1 if the directory cannot
+ * be read.
+ */
+int
+list_dir(int fd, const char *path, struct dirlist *list, int flags)
+{
+    blkcnt_t total;
+
+    if (load_dir(fd, path, list, flags, &total) < 0) {
+        return -1;
+    }
+    show_dir(fd, path, list, flags, total);
+    return 0;
+}
 
+/*
+ * lists a directory read with all of its entries under --du, once the
+ * sums of the subtrees below it have been added to its directories. only
+ * the entries the flags list are kept in list. total is what they add up
+ * to, a file linked from more than one of them counted once.
+ */
 void
-free_exit(void)
+list_du(int fd, const char *path, struct dirlist *list, int flags,
+    blkcnt_t total)
 {
-    free(dirs);
-    free(files);
+    filter_entries(list, flags);
+    (void)count_entries(list, flags);
+    show_dir(fd, path, list, flags, total);
+}
+
+/*
+ * sorts the entries of list, the directory open as fd, and prints them
+ * along with their total.
+ */
+static void
+show_dir(int fd, const char *path, struct dirlist *list, int flags,
+    blkcnt_t total)
+{
+    int phase;
+
+    if (!unsorted(flags)) {
+        phase = STATS_ENTER(PHASE_SORT);
+        sort_entries(list, flags);
+        STATS_LEAVE(phase);
+    }
+
+    /* traverse_stream() can only print the total after the entries, and
+     * every other unsorted listing follows it */
+    if ((flags & FLAG_l) && !unsorted(flags)) {
+        print_total(total, flags);
+    }
+
+    print_entries(fd, path, list, flags);
+
+    if ((flags & FLAG_l) && unsorted(flags)) {
+        print_total(total, flags);
+    }
+}
+
+/*
+ * lists the directory open as fd, and under -R everything below it. fd is
+ * closed.
+ */
+static void
+traverse_dir(int fd, const char *path, int flags,
+    const struct ancestor *parent)
+{
+    struct dirlist list;
+
+    memset(&list, 0, sizeof(list));
+    if (list_dir(fd, path, &list, flags) == 0) {
+        /* write out the whole directory at once */
+        out_boundary();
+
+        if (flags & FLAG_R) {
+            descend(fd, path, &list, flags, parent);
+        }
+    }
+
+    free_dirlist(&list);
+    (void)close(fd);
+}
+
+/*
+ * like traverse_dir(), but for -f, where nothing has to be sorted. the
+ * entries are read, fetched and printed a batch at a time, so the memory
+ * taken does not depend on the size of the directory. the total can only
+ * be printed after the entries. only the names of the directories below
+ * are kept under -R. fd is closed.
+ */
+static void
+traverse_stream(int fd, const char *path, int flags,
+    const struct ancestor *parent)
+{
+    blkcnt_t total = 0;
+    int n;
+    size_t i;
+    struct dirlist batch, subdirs;
+    struct dirname *ent;
+
+    memset(&batch, 0, sizeof(batch));
+    memset(&subdirs, 0, sizeof(subdirs));
+
+    while ((n = read_dirbatch(fd, &batch)) > 0) {
+        filter_entries(&batch, flags);
+        if (flags & FLAGS_STAT) {
+            total += fetch_entries(fd, &batch, flags);
+        }
+        print_entries(fd, path, &batch, flags);
+
+        /* the type of an entry is only known once it has been printed */
+        for (i = 0; (flags & FLAG_R) && i < batch.nents; i++) {
+            ent = &batch.ents[i];
+            if (ent->type == DT_DIR && !is_dots(ent->name)) {
+                (void)push_dirname(&subdirs, ent->name, ent->type);
+            }
+        }
+    }
+    if (n < 0) {
+        (void)fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+    }
+
+    /* under --top, the entries kept are only known now, after the total.
+     * under -R they are the first of the whole tree, printed at the end */
+    if ((flags & FLAG_l) && !whole_paths(flags)) {
+        print_total(total, flags);
+    }
+    if ((flags & FLAG_top) && !(flags & FLAG_R)) {
+        top_print(fd, path);
+    }
+    out_boundary();
+    free_dirlist(&batch);
+
+    if (flags & FLAG_R) {
+        descend(fd, path, &subdirs, flags, parent);
+    }
+
+    free_dirlist(&subdirs);
+    (void)close(fd);
 }
 
 /*
@@ -33,51 +489,20 @@ traverse(char *paths[], int flags)
     char *file, *path;
     FTS *fts;
     FTSENT *entry;
-    int (*compar)(const FTSENT **, const FTSENT **) = ascending;
+    cmp_func compar = get_compar(flags);
     int options = FTS_WHITEOUT | FTS_PHYSICAL;
     int info, level, stop_traverse, print_header; 
     int print_dot = flags & (FLAG_A | FLAG_a);
     int num_headers = 0;
-    long blk_size = 0;
-
-    if (flags & FLAG_f) {
-        compar = NULL;
-    }
-    if (flags & FLAG_S) {
-        if (flags & FLAG_r) {
-            compar = size_rev;
-        } else {
-            compar = size;
-        }
-    }
-    if (flags & FLAG_t) {
-        if (flags & FLAG_r) {
-            compar = file_mtime_rev;
-        } else {
-            compar = file_mtime;
-        }
-        if (flags & FLAG_u) {
-            if (flags & FLAG_r) {
-                compar = file_atime_rev;
-            } else {
-                compar = file_atime;
-            }
-        } else if (flags & FLAG_c) {
-            if (flags & FLAG_r) {
-                compar = file_ctime_rev;
-            } else {
-                compar = file_ctime;
-            }
-        }
-    }
+    int fd;
 
     if (flags & FLAG_a) {
         options |= FTS_SEEDOT;
     }
 
     if ((fts = fts_open(paths, options, compar)) == NULL) {
-        (void)fprintf(stderr, "ls: fts_open: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        fail("fts_open");
+        return;
     }
 
     while ((entry = fts_read(fts))) {
@@ -104,188 +529,98 @@ traverse(char *paths[], int flags)
 
             print_header = print_header && (!stop_traverse || !(flags & FLAG_R));
 
-            if (flags & FLAG_d) {
-                printf("%s\n", path);
+            if ((flags & FLAG_d) && (flags & FLAGS_RECORD)) {
+                print_record(AT_FDCWD, path, NULL, entry->fts_statp);
+            } else if (flags & FLAG_d) {
+                out_str(path);
+                out_endline();
             }
             if (flags & FLAG_headers) {
                 if (num_headers > 0 && ((!stop_traverse) || !(flags & FLAG_R))) {
-                    printf("\n");
+                    out_endline();
                 }
 
                 if (print_header) {
-                    printf("%s:\n", path);
+                    out_str(path);
+                    out_char(':');
+                    out_endline();
                 }
                 num_headers++;
             }
-            if (flags & FLAG_l && ((!stop_traverse) || !(flags & FLAG_R))) {
-                blk_size = get_dir_blk_size(path, flags);
-                if (blk_size >= 0) {
-                    printf("total ");
-                    if (flags & FLAG_h) {
-                        humanize(blk_size);
-                        printf("\n");
-                    } else {
-                        printf("%ld\n", blk_size);
-                    }
-                }
-            }
-
             if (stop_traverse || (flags & FLAG_d)) {
                 if (fts_set(fts, entry, FTS_SKIP) < 0) { 
-                    (void)fprintf(stderr, "ls: fts_set: %s\n", strerror(errno));
-                    exit(EXIT_FAILURE);
+                    fail("fts_set");
+                    break;
                 }
             }
 
             if (!(flags & FLAG_d) && ((!stop_traverse) || !(flags & FLAG_R))) {
-                traverse_children(fts, flags, print_dot);
+                /* traverse_dir() does its own descent, fts must not */
+                if (fts_set(fts, entry, FTS_SKIP) < 0) { 
+                    fail("fts_set");
+                    break;
+                }
+                STATS_COUNT(CALL_OPEN);
+                if ((fd = open(entry->fts_accpath, O_RDONLY | O_DIRECTORY)) < 0) {
+                    (void)fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+                } else if (streamed(flags)) {
+                    traverse_stream(fd, path, flags, NULL);
+                } else {
+                    traverse_dir(fd, path, flags, NULL);
+                }
             }
         } else if (info != FTS_D && info != FTS_DP && level == 0) {
-            print_file(file, path, entry->fts_statp, flags);
+            /* an operand is named by its whole path, as it was given */
+            print_file(AT_FDCWD, path, NULL, entry->fts_statp);
         }
     }
 
     if (fts_close(fts) < 0) {
-        (void)fprintf(stderr, "ls: fts_close: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        fail("fts_close");
     }
 }
 
+/*
+ * lists the operands paths, a NULL terminated array, or "." if there are
+ * none: first the files among them, then the directories, with nworkers
+ * threads under -R or --du.
+ */
 void
-traverse_children(FTS *fts, int flags, int print_hidden)
+list_paths(char *const paths[], int flags, int nworkers)
 {
-    char *file;
-    FTSENT *children = fts_children(fts, 0);
-    FTSENT *node = children;
-
-    while (node != NULL) {
-        file = node->fts_name;
+    char **dirs, **files;
+    int dirsp = 0, filesp = 0;
+    size_t i, n;
+    struct stat info;
 
-        if ((print_hidden && is_hidden(file)) || !is_hidden(file)) {
-            print_file(file, node->fts_path, node->fts_statp, flags);
-        }
-        node = node->fts_link;
+    for (n = 0; paths != NULL && paths[n] != NULL; n++) {
+        continue;
     }
-}
 
-static void
-usage()
-{
-    (void)fprintf(stderr, "usage: ls [-AacdFfhiklnqRrSstuw] [file ...]\n");
-    exit(EXIT_FAILURE);
-}
+    /* fts_open(3) needs NULL terminated arrays, leave room for "." too */
+    dirs = calloc(n + 2, sizeof(char *));
+    files = calloc(n + 1, sizeof(char *));
 
-int
-main(int argc, char *argv[])
-{
-    int ch, dirsp = 0, filesp = 0, flags = 0, i;
-    struct stat info;
-    
-    if (atexit(free_exit) != 0) {
-        perror("can't register free_exit\n");
-		exit(EXIT_FAILURE);
-	}
-
-    dirs = malloc(argc * sizeof(char *));
-    files = malloc(argc * sizeof(char *));
-
-    if (dirs == NULL) {
-        (void)fprintf(stderr, "ls: malloc: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-    if (files == NULL) {
-        (void)fprintf(stderr, "ls: malloc: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+    if (dirs == NULL || files == NULL) {
+        fail("calloc");
+        free(dirs);
+        free(files);
+        return;
     }
 
-    while ((ch = getopt(argc, argv, "AacdFfhiklnqRrSstuw")) != -1) {
-        switch (ch) {
-        case 'A':
-            flags |= FLAG_A;
-            break;
-        case 'a':
-            flags |= FLAG_a;
-            break;
-        case 'c':
-            flags |= FLAG_c;
-            flags &= ~FLAG_u; /* if -c is set, turn off -u */ 
-            break;
-        case 'd':
-            flags |= FLAG_d;
-            flags &= ~FLAG_R; /* if -d is set, -R must be turned off */
-            break;
-        case 'F':
-            flags |= FLAG_F;
-            break;
-        case 'f':
-            flags |= FLAG_f;
-            flags |= FLAG_a; /* like NetBSD, -f implies -a */
-            break;
-        case 'h':
-            flags |= FLAG_h;
-            flags &= ~FLAG_k; /* if -h is set, turn off -k */ 
-            break;
-        case 'i':
-            flags |= FLAG_i;
-            break;
-        case 'k':
-            flags |= FLAG_k;
-            flags &= ~FLAG_h; /* if -k is set, turn off -h */ 
-            break;
-        case 'l':
-            flags |= FLAG_l;
-            break;
-        case 'n':
-            flags |= FLAG_n;
-            flags |= FLAG_l; /* -n implies -l */
-            break;
-        case 'q':
-            flags |= FLAG_q;
-            break;
-        case 'R':
-            /* if -d is set, don't turn on -R */
-            flags = (flags & FLAG_d) ? flags : flags | FLAG_R;
-            break;
-        case 'r':
-            flags |= FLAG_r;
-            break;
-        case 'S':
-            flags |= FLAG_S;
-            break;
-        case 's':
-            flags |= FLAG_s;
-            break;
-        case 't':
-            flags |= FLAG_t;
-            break;
-        case 'u':
-            flags |= FLAG_u;
-            flags &= ~FLAG_c; /* if -u is set, turn off -c */ 
-            break;
-        case 'w':
-            flags |= FLAG_w;
-            break;
-        case '?':
-        default:
-            usage();
-        }
-    }
-    argc -= optind;
-    argv += optind;
-
     /* here, find which arguments are directories and which are files,
      * that way, we can traverse the files first and then directories since
      * fts_open does not do that */
-    for (i = 0; i < argc; i++) {
-        if (lstat(argv[i], &info) < 0) {
+    for (i = 0; i < n; i++) {
+        if (lstat(paths[i], &info) < 0) {
             (void)fprintf(stderr, "ls: lstat: %s\n", strerror(errno));
             continue;
         }
 
         if (S_ISDIR(info.st_mode)) {
-            dirs[dirsp++] = argv[i];
+            dirs[dirsp++] = paths[i];
         } else {
-            files[filesp++] = argv[i];
+            files[filesp++] = paths[i];
         }
     }
 
@@ -298,8 +633,8 @@ main(int argc, char *argv[])
         traverse(files, flags);
     }
     if (dirsp > 0) {
-        if (filesp > 0) {
-            printf("\n");
+        if (filesp > 0 && !whole_paths(flags)) {
+            out_endline();
             flags |= FLAG_headers;
         }
 
@@ -311,10 +646,23 @@ main(int argc, char *argv[])
             flags |= FLAG_headers;
         }
 
-        traverse(dirs, flags);
+        if (whole_paths(flags)) {
+            flags &= ~FLAG_headers;
+        }
+
+        /* --top keeps a single heap, which the workers cannot share. the
+         * workers sum up the subtrees of --du, with or without -R or -d. a
+         * function handed the entries gets them in the calling thread */
+        if (flags & FLAG_du) {
+            traverse_parallel(dirs, flags, nworkers);
+        } else if ((flags & FLAG_R) && nworkers > 1
+            && !(flags & (FLAG_top | FLAG_call))) {
+            traverse_parallel(dirs, flags, nworkers);
+        } else {
+            traverse(dirs, flags);
+        }
     }
 
-    free (files);
-    free(dirs); /* create exit handler for this later! */
-    return 0;
+    free(dirs);
+    free(files);
 }
@@ -3,9 +3,19 @@
 
 #include <fts.h>
 
-static void usage(void);
+#include "dirlist.h"
+#include "lsdir.h"
+
 void traverse(char *[], int);
-void traverse_children(FTS *, int, int);
+int load_dir(int, const char *, struct dirlist *, int, blkcnt_t *);
+int list_dir(int, const char *, struct dirlist *, int);
+void list_du(int, const char *, struct dirlist *, int, blkcnt_t);
+int is_listed(const char *, unsigned char, int);
+void list_paths(char *const [], int, int);
+int lsdir_setup(const struct lsdir_options *);
+int lsdir_run(char *const [], int, int);
+void lsdir_free(void);
+void free_exit(void);
 int main(int, char *[]);
 int should_print(FTSENT *, int);
 int print_hidden(const char *, int);
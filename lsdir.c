@@ -0,0 +1,270 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "dirlist.h"
+#include "flags.h"
+#include "ls.h"
+#include "lsdir.h"
+#include "match.h"
+#include "meta.h"
+#include "output.h"
+#include "print.h"
+#include "sort.h"
+#include "timefmt.h"
+#include "top.h"
+#include "utils.h"
+
+void
+lsdir_defaults(struct lsdir_options *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->threads = 1;
+}
+
+static int
+add_patterns(int which, const char **list)
+{
+    for (; list != NULL && *list != NULL; list++) {
+        if (match_add(which, *list) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * turns opts into the flags of a listing and sets up everything it is
+ * printed by, or handed to a function by if call is set. returns -1 with
+ * errno set, to EINVAL if the options do not go together.
+ */
+static int
+setup(const struct lsdir_options *opts, int call)
+{
+    int flags = 0;
+
+    /* the sums of a directory are only known once its subtree is read,
+     * which --top does not keep */
+    if (opts->top > 0 && opts->du) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    flags |= opts->all ? FLAG_a : 0;
+    flags |= opts->almost_all ? FLAG_A : 0;
+    flags |= opts->reverse ? FLAG_r : 0;
+    flags |= opts->du ? FLAG_du : 0;
+
+    /* -d wins over -R */
+    if (opts->directory) {
+        flags |= FLAG_d;
+    } else if (opts->recursive) {
+        flags |= FLAG_R;
+    }
+
+    switch (opts->sort) {
+    case LSDIR_SORT_SIZE:
+        flags |= FLAG_S;
+        break;
+    case LSDIR_SORT_TIME:
+        flags |= FLAG_t;
+        break;
+    case LSDIR_SORT_NONE:
+        /* like NetBSD, -f implies -a */
+        flags |= FLAG_f | FLAG_a;
+        break;
+    }
+
+    if (opts->time == LSDIR_TIME_ACCESS) {
+        flags |= FLAG_u;
+    } else if (opts->time == LSDIR_TIME_CHANGE) {
+        flags |= FLAG_c;
+    }
+
+    if (call) {
+        /* only what the function asked for is fetched, -l and -i being
+         * what has every field of an entry fetched */
+        flags |= FLAG_call;
+        if (opts->metadata) {
+            flags |= FLAG_i | FLAG_l;
+        }
+    } else {
+        flags |= opts->long_format ? FLAG_l : 0;
+        flags |= opts->numeric ? FLAG_n | FLAG_l : 0; /* -n implies -l */
+        flags |= opts->inode ? FLAG_i : 0;
+        flags |= opts->blocks ? FLAG_s : 0;
+        flags |= opts->classify ? FLAG_F : 0;
+        flags |= opts->escape_names ? FLAG_q : 0;
+        flags |= opts->raw_names ? FLAG_w : 0;
+        if (opts->human) {
+            flags |= FLAG_h;
+        } else if (opts->kilobytes) {
+            flags |= FLAG_k;
+        }
+
+        if (opts->format == LSDIR_FORMAT_NUL) {
+            flags |= FLAG_nul;
+        } else if (opts->format == LSDIR_FORMAT_JSON) {
+            flags |= FLAG_json;
+        } else if (opts->format == LSDIR_FORMAT_BINARY) {
+            flags |= FLAG_binary;
+        }
+
+        /* a record has every field, in bytes and blocks rather than
+         * humanized */
+        if (flags & FLAGS_RECORD) {
+            flags |= FLAG_i | FLAG_l;
+            flags &= ~FLAG_h;
+        }
+    }
+
+    if (opts->top > 0) {
+        flags |= FLAG_top;
+    }
+
+    free_match();
+    if (add_patterns(MATCH_INCLUDE, opts->include) < 0
+        || add_patterns(MATCH_EXCLUDE, opts->exclude) < 0
+        || add_patterns(MATCH_PRUNE, opts->prune) < 0) {
+        free_match();
+        return -1;
+    }
+    if (opts->include != NULL || opts->exclude != NULL
+        || opts->prune != NULL) {
+        flags |= FLAG_match;
+    }
+
+    sort_init();
+    if (flags & FLAG_top) {
+        top_init(opts->top, flags);
+    }
+    meta_init(flags, opts->dont_sync);
+
+    /* the entries of a large directory are fetched by -P threads as well,
+     * with or without -R */
+    meta_threads(opts->threads);
+
+    /* before -P starts any thread, the flags are final as far as printing
+     * an entry is concerned */
+    print_init(flags);
+    if ((flags & FLAG_l) && !(flags & FLAGS_RECORD)) {
+        timefmt_init();
+    }
+    return flags;
+}
+
+/*
+ * sets up a listing by opts for ls, which has a few more things of its own
+ * to set up around it. returns its flags, or -1 if the options do not go
+ * together.
+ */
+int
+lsdir_setup(const struct lsdir_options *opts)
+{
+    return setup(opts, 0);
+}
+
+/*
+ * lists paths, a NULL terminated array, by flags with nworkers threads.
+ * returns -1, with errno set, if what was listed could not be written.
+ */
+int
+lsdir_run(char *const paths[], int flags, int nworkers)
+{
+    if (flags & FLAG_binary) {
+        print_binary_header(flags);
+    }
+
+    list_paths(paths, flags, nworkers);
+
+    /* the first entries of the whole tree */
+    if ((flags & FLAG_top) && (flags & FLAG_R)) {
+        top_print(AT_FDCWD, NULL);
+    }
+
+    return out_flush();
+}
+
+/*
+ * frees what a listing holds on to once it is done.
+ */
+void
+lsdir_free(void)
+{
+    free_top();
+    free_match();
+    free_dirbuf();
+}
+
+/*
+ * frees what a listing of lsdir_print() or lsdir_walk() holds on to, and
+ * returns rv, or -1 with errno set if anything failed along the way.
+ */
+static int
+finish(int rv)
+{
+    int err = rv < 0 ? errno : failed();
+
+    lsdir_free();
+    fail_return(0);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return rv;
+}
+
+/*
+ * prints the listing of paths, a NULL terminated array or NULL for ".", by
+ * opts to fd. returns 0, or -1 with errno set if the options do not go
+ * together, the listing could not be written or there was no room for
+ * it, in which case what could be is printed all the same.
+ */
+int
+lsdir_print(char *const paths[], const struct lsdir_options *opts, int fd)
+{
+    int flags;
+
+    fail_return(1);
+    out_init(fd);
+    if ((flags = setup(opts, 0)) < 0) {
+        return finish(-1);
+    }
+    return finish(lsdir_run(paths, flags, opts->threads));
+}
+
+/*
+ * hands every entry of the listing of paths, a NULL terminated array or
+ * NULL for ".", by opts to func with arg, in the order they would be
+ * printed in. returns 0, or -1 with errno set if the options do not go
+ * together or there was no room for the listing, in which case what could
+ * be is handed to func all the same. the subtree sums of --du are only
+ * ever printed.
+ */
+int
+lsdir_walk(char *const paths[], const struct lsdir_options *opts,
+    lsdir_func func, void *arg)
+{
+    int flags;
+
+    if (opts->du) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fail_return(1);
+    print_callback(func, arg);
+    if ((flags = setup(opts, 1)) < 0) {
+        return finish(-1);
+    }
+
+    /* nothing is written, the function gets what would have been */
+    list_paths(paths, flags, opts->threads);
+    if ((flags & FLAG_top) && (flags & FLAG_R)) {
+        top_print(AT_FDCWD, NULL);
+    }
+    return finish(0);
+}
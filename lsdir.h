@@ -0,0 +1,105 @@
+#ifndef _LSDIR_H_
+#define _LSDIR_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stddef.h>
+
+/* liblsdir is built with every other symbol hidden */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define LSDIR_API __attribute__((visibility("default")))
+#else
+#define LSDIR_API
+#endif
+
+/*
+ * liblsdir, the listing ls is made of, for programs to list directories
+ * without running ls and parsing what it prints. a listing is either
+ * rendered as ls would print it, by lsdir_print(), or handed to a
+ * function entry by entry, by lsdir_walk(). one listing is made at a time,
+ * by one thread. errors about what cannot be listed are reported on
+ * standard error like ls does. where ls would exit, on running out of
+ * memory or failing to write, the rest of the listing is made without
+ * what failed and the call returns -1 with errno set.
+ */
+
+/* the order of the entries of a directory */
+#define LSDIR_SORT_NAME 0
+#define LSDIR_SORT_SIZE 1       /* -S, largest first */
+#define LSDIR_SORT_TIME 2       /* -t, newest first */
+#define LSDIR_SORT_NONE 3       /* -f, as read, which implies -a */
+
+/* the time listed and sorted by */
+#define LSDIR_TIME_MODIFY 0
+#define LSDIR_TIME_ACCESS 1     /* -u */
+#define LSDIR_TIME_CHANGE 2     /* -c */
+
+/* what lsdir_print() renders */
+#define LSDIR_FORMAT_TEXT 0
+#define LSDIR_FORMAT_NUL 1      /* --format nul */
+#define LSDIR_FORMAT_JSON 2     /* --format json */
+#define LSDIR_FORMAT_BINARY 3   /* --format binary */
+
+/*
+ * what is listed and how, each field is the ls option in its comment.
+ * lsdir_defaults() sets up a plain ls. the patterns are NULL terminated
+ * arrays, or NULL for none.
+ */
+struct lsdir_options {
+    int all;                    /* -a */
+    int almost_all;             /* -A */
+    int directory;              /* -d, wins over recursive */
+    int recursive;              /* -R */
+    int sort;                   /* LSDIR_SORT_* */
+    int reverse;                /* -r */
+    int time;                   /* LSDIR_TIME_* */
+    int threads;                /* -P */
+    size_t top;                 /* --top, 0 for every entry */
+    int du;                     /* --du */
+    int dont_sync;              /* --dont-sync */
+    const char **include;       /* --include */
+    const char **exclude;       /* --exclude */
+    const char **prune;         /* --prune */
+
+    /* only used by lsdir_walk() */
+    int metadata;               /* fill in every field of sb */
+
+    /* only used by lsdir_print() */
+    int format;                 /* LSDIR_FORMAT_* */
+    int long_format;            /* -l */
+    int numeric;                /* -n, implies long_format */
+    int inode;                  /* -i */
+    int blocks;                 /* -s */
+    int human;                  /* -h */
+    int kilobytes;              /* -k */
+    int classify;               /* -F */
+    int escape_names;           /* -q */
+    int raw_names;              /* -w, wins over escape_names */
+};
+
+/*
+ * an entry handed to the function of lsdir_walk(). dir is the path of the
+ * directory it is in and name its name there, an operand has a NULL dir
+ * and name is its path as it was given. unless metadata is set, only the
+ * type in st_mode is filled in. target is the target of a symbolic link,
+ * of targetlen bytes and not NUL terminated, if metadata is set. under
+ * recursive, the directories below are walked after the entries of their
+ * parent, in the order ls lists them. nothing is valid beyond the call.
+ */
+struct lsdir_entry {
+    const char *dir;
+    const char *name;
+    const struct stat *sb;
+    const char *target;
+    size_t targetlen;
+};
+
+typedef void (*lsdir_func)(const struct lsdir_entry *, void *);
+
+LSDIR_API void lsdir_defaults(struct lsdir_options *);
+LSDIR_API int lsdir_print(char *const [], const struct lsdir_options *, int);
+LSDIR_API int lsdir_walk(char *const [], const struct lsdir_options *,
+    lsdir_func, void *);
+
+#endif
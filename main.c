@@ -0,0 +1,381 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "flags.h"
+#include "idcache.h"
+#include "ls.h"
+#include "lsdir.h"
+#include "meta.h"
+#include "output.h"
+#include "parallel.h"
+#include "serve.h"
+#include "stats.h"
+#include "top.h"
+
+/* long options which have no single letter equivalent */
+#define OPT_PASSWD 256
+#define OPT_GROUP 257
+#define OPT_DONT_SYNC 258
+#define OPT_URING 259
+#define OPT_STATS 260
+#define OPT_CACHE 261
+#define OPT_CACHE_STRICT 262
+#define OPT_SERVE 263
+#define OPT_CONNECT 264
+#define OPT_FORMAT 265
+#define OPT_TOP 266
+#define OPT_DU 267
+#define OPT_INCLUDE 268
+#define OPT_EXCLUDE 269
+#define OPT_PRUNE 270
+#define OPT_PIPELINE 271
+
+static struct option long_options[] = {
+    { "passwd", required_argument, NULL, OPT_PASSWD },
+    { "group", required_argument, NULL, OPT_GROUP },
+    { "dont-sync", no_argument, NULL, OPT_DONT_SYNC },
+    { "uring", required_argument, NULL, OPT_URING },
+    { "stats", no_argument, NULL, OPT_STATS },
+    { "cache", required_argument, NULL, OPT_CACHE },
+    { "cache-strict", no_argument, NULL, OPT_CACHE_STRICT },
+    { "serve", required_argument, NULL, OPT_SERVE },
+    { "connect", required_argument, NULL, OPT_CONNECT },
+    { "format", required_argument, NULL, OPT_FORMAT },
+    { "top", required_argument, NULL, OPT_TOP },
+    { "du", no_argument, NULL, OPT_DU },
+    { "include", required_argument, NULL, OPT_INCLUDE },
+    { "exclude", required_argument, NULL, OPT_EXCLUDE },
+    { "prune", required_argument, NULL, OPT_PRUNE },
+    { "pipeline", required_argument, NULL, OPT_PIPELINE },
+    { NULL, 0, NULL, 0 }
+};
+
+/* the patterns of --include, --exclude and --prune, NULL terminated */
+static const char **patterns[3];
+
+/*
+ * frees everything the listing may still hold, at exit or once a server
+ * process has answered its request.
+ */
+void
+free_exit(void)
+{
+    free(patterns[0]);
+    free(patterns[1]);
+    free(patterns[2]);
+    free_idcache();
+    free_meta();
+    free_cache();
+    lsdir_free();
+
+    /* on an early exit, still write out what has been listed so far */
+    (void)out_flush();
+
+    if (stats_enabled) {
+        stats_print();
+    }
+}
+
+static void
+usage()
+{
+    (void)fprintf(stderr, "usage: ls [-AacdFfhiklnqRrSstuw] [-P threads] "
+        "[--passwd file] [--group file] [--dont-sync] [--uring depth] "
+        "[--stats] [--cache file [--cache-strict]] [--serve socket] "
+        "[--connect socket] [--format nul|json|binary] [--top n] [--du] "
+        "[--include pattern] [--exclude pattern] [--prune pattern] "
+        "[--pipeline buffers] [file ...]\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * adds pattern to the NULL terminated list of patterns at *list.
+ */
+static void
+add_pattern(const char ***list, const char *pattern)
+{
+    const char **p;
+    size_t n = 0;
+
+    while (*list != NULL && (*list)[n] != NULL) {
+        n++;
+    }
+    if ((p = realloc(*list, (n + 2) * sizeof(*p))) == NULL) {
+        (void)fprintf(stderr, "ls: realloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    p[n] = pattern;
+    p[n + 1] = NULL;
+    *list = p;
+}
+
+/*
+ * parses a number for the option name of at least min and at most max,
+ * exits with what msg says about it if it is not one.
+ */
+static long
+number(const char *arg, long min, long max, const char *msg)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || errno != 0 || n < min || n > max) {
+        (void)fprintf(stderr, "ls: invalid %s: %s\n", msg, arg);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+/*
+ * ls itself is a client of the library: the command line is turned into
+ * its options, and what only a process of its own can do, the cache, the
+ * server, io_uring(7) and the writer thread, is set up around the listing.
+ */
+int
+main(int argc, char *argv[])
+{
+    char *cachefile = NULL, *connectpath = NULL, *servepath = NULL;
+    char *dot[] = { ".", NULL };
+    int ch, depth = 0, flags, pipeline = 0, status, strict = 0;
+    struct lsdir_options opts;
+
+    /* names are sorted in the order of the user's locale */
+    (void)setlocale(LC_COLLATE, "");
+
+    out_init(STDOUT_FILENO);
+
+    /* a server process answering a request has it from the server */
+    if (!served && atexit(free_exit) != 0) {
+        perror("can't register free_exit\n");
+		exit(EXIT_FAILURE);
+	}
+
+    lsdir_defaults(&opts);
+    while ((ch = getopt_long(argc, argv, "AacdFfhiklnP:qRrSstuw", long_options,
+        NULL)) != -1) {
+        switch (ch) {
+        case 'A':
+            opts.almost_all = 1;
+            break;
+        case 'a':
+            opts.all = 1;
+            break;
+        case 'c':
+            opts.time = LSDIR_TIME_CHANGE;
+            break;
+        case 'd':
+            opts.directory = 1;
+            break;
+        case 'F':
+            opts.classify = 1;
+            break;
+        case 'f':
+            /* like NetBSD, -f implies -a. -S and -t still sort */
+            opts.all = 1;
+            if (opts.sort == LSDIR_SORT_NAME) {
+                opts.sort = LSDIR_SORT_NONE;
+            }
+            break;
+        case 'h':
+            opts.human = 1;
+            opts.kilobytes = 0; /* if -h is set, turn off -k */
+            break;
+        case 'i':
+            opts.inode = 1;
+            break;
+        case 'k':
+            opts.kilobytes = 1;
+            opts.human = 0; /* if -k is set, turn off -h */
+            break;
+        case 'l':
+            opts.long_format = 1;
+            break;
+        case 'n':
+            opts.numeric = 1; /* -n implies -l */
+            break;
+        case 'P':
+            /* number of threads listing directories under -R */
+            opts.threads = (int)number(optarg, 1, MAX_WORKERS,
+                "number of threads");
+            break;
+        case 'q':
+            opts.escape_names = 1;
+            break;
+        case 'R':
+            /* -d wins over -R whichever comes first */
+            opts.recursive = 1;
+            break;
+        case 'r':
+            opts.reverse = 1;
+            break;
+        case 'S':
+            /* -t wins over -S whichever comes first */
+            if (opts.sort != LSDIR_SORT_TIME) {
+                opts.sort = LSDIR_SORT_SIZE;
+            }
+            break;
+        case 's':
+            opts.blocks = 1;
+            break;
+        case 't':
+            opts.sort = LSDIR_SORT_TIME;
+            break;
+        case 'u':
+            opts.time = LSDIR_TIME_ACCESS;
+            break;
+        case 'w':
+            opts.raw_names = 1;
+            break;
+        case OPT_PASSWD:
+            /* resolve user names from this file only, never through NSS */
+            load_passwd(optarg);
+            break;
+        case OPT_GROUP:
+            /* resolve group names from this file only, never through NSS */
+            load_group(optarg);
+            break;
+        case OPT_DONT_SYNC:
+            /* accept attributes cached by a network file system client */
+            opts.dont_sync = 1;
+            break;
+        case OPT_URING:
+            /* number of stat requests kept in flight through io_uring */
+            depth = (int)number(optarg, 1, MAX_URING_DEPTH, "queue depth");
+            break;
+        case OPT_CACHE:
+            /* reuse the entries of directories which have not changed */
+            cachefile = optarg;
+            break;
+        case OPT_CACHE_STRICT:
+            /* still read everything, and report where the cache is stale */
+            strict = 1;
+            break;
+        case OPT_SERVE:
+            /* keep the tree in memory and list from it for clients */
+            servepath = optarg;
+            break;
+        case OPT_CONNECT:
+            /* have a server list from its tree, if there is one */
+            connectpath = optarg;
+            break;
+        case OPT_FORMAT:
+            /* records of raw fields for other programs to read */
+            if (strcmp(optarg, "nul") == 0) {
+                opts.format = LSDIR_FORMAT_NUL;
+            } else if (strcmp(optarg, "json") == 0) {
+                opts.format = LSDIR_FORMAT_JSON;
+            } else if (strcmp(optarg, "binary") == 0) {
+                opts.format = LSDIR_FORMAT_BINARY;
+            } else {
+                (void)fprintf(stderr, "ls: invalid format: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_TOP:
+            /* only the first n entries, in the order of the flags */
+            opts.top = (size_t)number(optarg, 1, MAX_TOP,
+                "number of entries");
+            break;
+        case OPT_DU:
+            /* the sums of the subtrees below the directories listed */
+            opts.du = 1;
+            break;
+        case OPT_INCLUDE:
+            /* only entries whose names match, and directories */
+            add_pattern(&patterns[0], optarg);
+            break;
+        case OPT_EXCLUDE:
+            /* no entries whose names match */
+            add_pattern(&patterns[1], optarg);
+            break;
+        case OPT_PRUNE:
+            /* no descent into directories whose names match */
+            add_pattern(&patterns[2], optarg);
+            break;
+        case OPT_PIPELINE:
+            /* buffers filled ahead of a thread writing them out */
+            pipeline = (int)number(optarg, 2, MAX_PIPELINE,
+                "number of buffers");
+            break;
+        case OPT_STATS:
+            /* count the calls and time the phases, summed up at exit */
+            stats_init();
+            break;
+        case '?':
+        default:
+            usage();
+        }
+    }
+    opts.include = patterns[0];
+    opts.exclude = patterns[1];
+    opts.prune = patterns[2];
+
+    /* a server process answering a request does not pass it on */
+    if (served) {
+        connectpath = servepath = NULL;
+    }
+    if (connectpath != NULL
+        && (status = request(connectpath, argc, argv)) >= 0) {
+        return status;
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((flags = lsdir_setup(&opts)) < 0) {
+        usage();
+    }
+
+    /* what the patterns pick is not cached, it is cheap to pick again.
+     * a server keeps no tree for them either, its clients' may differ */
+    if (servepath != NULL && (flags & FLAG_match)) {
+        usage();
+    }
+    if (cachefile != NULL && !(flags & FLAG_match)) {
+        cache_open(cachefile, flags, strict);
+    } else if (strict && cachefile == NULL) {
+        usage();
+    }
+
+    /* the tree of the server was listed with flags of its own */
+    if (served) {
+        cache_match(flags);
+    }
+
+    /* without io_uring, the metadata is fetched one entry at a time */
+    if (depth > 0) {
+        (void)meta_uring(depth);
+    }
+
+    /* a server walks the directories among the operands */
+    if (servepath != NULL) {
+        serve(servepath, argc > 0 ? argv : dot, flags);
+    }
+
+    /* not before serve(), a fork(2) would leave the writer behind */
+    if (pipeline > 0) {
+        out_pipeline(pipeline);
+    }
+
+    if (lsdir_run(argv, flags, opts.threads) < 0) {
+        (void)fprintf(stderr, "ls: write: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* only a run which got this far updates the cache */
+    cache_save();
+
+    /* the patterns and the id cache are freed by free_exit */
+    return 0;
+}
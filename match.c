@@ -0,0 +1,206 @@
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+#include "utils.h"
+
+/*
+ * what a pattern was compiled into. most patterns are a literal name, or a
+ * literal with a leading or trailing "*", which are matched with a single
+ * comparison. anything else is left to fnmatch(3).
+ */
+enum patkind {
+    PAT_LITERAL,    /* "name" */
+    PAT_PREFIX,     /* "name*" */
+    PAT_SUFFIX,     /* "*name" */
+    PAT_INFIX,      /* "*name*" */
+    PAT_ANY,        /* "*" */
+    PAT_GLOB
+};
+
+/*
+ * a compiled pattern. str is the literal part of it, len its length, or
+ * the whole pattern for PAT_GLOB.
+ */
+struct pattern {
+    enum patkind kind;
+    char *str;
+    size_t len;
+};
+
+struct patlist {
+    struct pattern *pats;
+    size_t npats;
+    size_t cap;
+};
+
+static struct patlist lists[MATCH_PRUNE + 1];
+
+/*
+ * checks whether the n characters at s are free of anything fnmatch(3)
+ * treats specially.
+ */
+static int
+is_literal(const char *s, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+compile(struct pattern *pat, const char *src)
+{
+    size_t len = strlen(src), lead, trail;
+
+    lead = len > 0 && src[0] == '*';
+    trail = len > lead && src[len - 1] == '*';
+
+    if (lead && len == 1) {
+        pat->kind = PAT_ANY;
+    } else if (!is_literal(src + lead, len - lead - trail)) {
+        pat->kind = PAT_GLOB;
+        lead = trail = 0;
+    } else if (lead && trail) {
+        pat->kind = PAT_INFIX;
+    } else if (lead) {
+        pat->kind = PAT_SUFFIX;
+    } else if (trail) {
+        pat->kind = PAT_PREFIX;
+    } else {
+        pat->kind = PAT_LITERAL;
+    }
+
+    pat->len = len - lead - trail;
+    if ((pat->str = malloc(pat->len + 1)) == NULL) {
+        fail("malloc");
+        return -1;
+    }
+    memcpy(pat->str, src + lead, pat->len);
+    pat->str[pat->len] = '\0';
+    return 0;
+}
+
+/*
+ * adds pattern to the list of --include, --exclude or --prune patterns
+ * given as which. returns -1 with errno set if there is no room for it.
+ */
+int
+match_add(int which, const char *pattern)
+{
+    struct patlist *list = &lists[which];
+    struct pattern *pats;
+    size_t cap;
+
+    if (list->npats == list->cap) {
+        cap = list->cap ? list->cap * 2 : 8;
+        if ((pats = realloc(list->pats, cap * sizeof(*pats))) == NULL) {
+            fail("realloc");
+            return -1;
+        }
+        list->pats = pats;
+        list->cap = cap;
+    }
+    if (compile(&list->pats[list->npats], pattern) < 0) {
+        return -1;
+    }
+    list->npats++;
+    return 0;
+}
+
+static int
+matches(const struct pattern *pat, const char *name)
+{
+    size_t len;
+
+    switch (pat->kind) {
+    case PAT_LITERAL:
+        return strcmp(name, pat->str) == 0;
+    case PAT_PREFIX:
+        return strncmp(name, pat->str, pat->len) == 0;
+    case PAT_SUFFIX:
+        len = strlen(name);
+        return len >= pat->len
+            && memcmp(name + len - pat->len, pat->str, pat->len) == 0;
+    case PAT_INFIX:
+        return strstr(name, pat->str) != NULL;
+    case PAT_ANY:
+        return 1;
+    default:
+        return fnmatch(pat->str, name, 0) == 0;
+    }
+}
+
+static int
+any_matches(const struct patlist *list, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < list->npats; i++) {
+        if (matches(&list->pats[i], name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * checks whether name matches one of the --exclude patterns.
+ */
+int
+match_excluded(const char *name)
+{
+    return any_matches(&lists[MATCH_EXCLUDE], name);
+}
+
+/*
+ * checks whether an entry with the name and the type getdents(2) reported
+ * is listed: it matches none of the --exclude patterns and, if there are
+ * --include patterns, one of them. directories are listed whatever the
+ * --include patterns, so what they hold can be. an entry of unknown type
+ * is kept until its type is known.
+ */
+int
+match_listed(const char *name, unsigned char type)
+{
+    if (any_matches(&lists[MATCH_EXCLUDE], name)) {
+        return 0;
+    }
+    return lists[MATCH_INCLUDE].npats == 0 || type == DT_DIR
+        || type == DT_UNKNOWN || any_matches(&lists[MATCH_INCLUDE], name);
+}
+
+/*
+ * checks whether the directory name matches one of the --prune patterns,
+ * it is listed but not descended into.
+ */
+int
+match_pruned(const char *name)
+{
+    return any_matches(&lists[MATCH_PRUNE], name);
+}
+
+void
+free_match(void)
+{
+    size_t i, j;
+
+    for (i = 0; i <= MATCH_PRUNE; i++) {
+        for (j = 0; j < lists[i].npats; j++) {
+            free(lists[i].pats[j].str);
+        }
+        free(lists[i].pats);
+        memset(&lists[i], 0, sizeof(lists[i]));
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef _MATCH_H_
+#define _MATCH_H_
+
+/* the lists of patterns --include, --exclude and --prune add to */
+#define MATCH_INCLUDE 0
+#define MATCH_EXCLUDE 1
+#define MATCH_PRUNE 2
+
+int match_add(int, const char *);
+int match_excluded(const char *);
+int match_listed(const char *, unsigned char);
+int match_pruned(const char *);
+void free_match(void);
+
+#endif
@@ -0,0 +1,552 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* statx(2) is only declared with the GNU extensions */
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+#include <linux/io_uring.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dirlist.h"
+#include "flags.h"
+#include "meta.h"
+#include "parallel.h"
+#include "stats.h"
+#include "utils.h"
+
+/* IORING_OP_STATX is an enum, but it came with the same kernel release as
+ * the probe of the operations a ring supports, whose flag is a macro. a
+ * kernel built without it is still asked at run time, see uring_statx() */
+#if defined(STATX_BASIC_STATS) && defined(IO_URING_OP_SUPPORTED)
+#define META_URING
+#endif
+
+/* the most operations the probe of uring_statx() has room for */
+#define URING_PROBE_OPS 256
+
+#ifdef STATX_BASIC_STATS
+/* the fields statx(2) is asked for, computed once from the flags */
+static unsigned int mask = STATX_TYPE;
+#endif
+static int statx_flags = AT_SYMLINK_NOFOLLOW;
+
+/* the flags meta_init() was called with, they decide what a list keeps */
+static int meta_flags;
+
+/* the threads the entries of a large directory are fetched by, see
+ * meta_threads() */
+static int nthreads = 1;
+
+/*
+ * the entries of a directory shared by the threads fetching them. each
+ * thread claims the next META_CHUNK entries until none are left.
+ */
+struct fetchjob {
+    int dirfd;
+    struct dirlist *list;
+    int *errs;
+    size_t next;
+};
+
+#ifdef META_URING
+/*
+ * an io_uring(7) instance the statx(2) calls of a whole directory are
+ * submitted through, at most depth of them in flight at once. every request
+ * in flight owns one of the bufs slots, the free ones are stacked in slots.
+ * under --stats, sent holds the time the request of each slot was queued.
+ * only the thread which set up the ring uses it, the -P workers fetch one
+ * entry at a time.
+ */
+struct uring {
+    int fd;
+    unsigned int depth;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    struct statx *bufs;
+    unsigned int *slots;
+    unsigned int nslots;
+    struct timespec *sent;
+};
+
+static __thread struct uring ring = { -1, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL, 0, 0, 0, NULL, NULL, 0, NULL };
+#endif
+
+/*
+ * works out which fields of the entries the given flags need. if nosync is
+ * set, the attributes may be served from the client's cache on network file
+ * systems instead of being revalidated with the server.
+ */
+void
+meta_init(int flags, int nosync)
+{
+    meta_flags = flags;
+#ifdef STATX_BASIC_STATS
+    mask = STATX_TYPE;
+
+    /* -F tells executable files apart */
+    if (flags & FLAG_F) {
+        mask |= STATX_MODE;
+    }
+    if (flags & FLAG_i) {
+        mask |= STATX_INO;
+    }
+    /* -h prints sizes instead of blocks, both for -s and for the total */
+    if (flags & (FLAG_s | FLAG_l)) {
+        mask |= (flags & FLAG_h) ? STATX_SIZE : STATX_BLOCKS;
+    }
+    if (flags & FLAG_S) {
+        mask |= STATX_SIZE;
+    }
+    if (flags & (FLAG_t | FLAG_l)) {
+        if (flags & FLAG_u) {
+            mask |= STATX_ATIME;
+        } else if (flags & FLAG_c) {
+            mask |= STATX_CTIME;
+        } else {
+            mask |= STATX_MTIME;
+        }
+    }
+    if (flags & FLAG_l) {
+        mask |= STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE;
+    }
+    /* --du sums sizes and blocks, and counts hard links once */
+    if (flags & FLAG_du) {
+        mask |= STATX_INO | STATX_NLINK | STATX_SIZE | STATX_BLOCKS;
+    }
+
+    /* the library may be set up again for another listing */
+    statx_flags = AT_SYMLINK_NOFOLLOW;
+    if (nosync) {
+        statx_flags |= AT_STATX_DONT_SYNC;
+    }
+#else
+    /* without statx(2) every field is fetched and always up to date */
+    (void)flags;
+    (void)nosync;
+#endif
+}
+
+#ifdef STATX_BASIC_STATS
+/*
+ * fills in sb from what statx(2) returned, the fields which were not asked
+ * for are zero.
+ */
+static void
+stat_from_statx(const struct statx *stx, struct stat *sb)
+{
+    memset(sb, 0, sizeof(*sb));
+    sb->st_mode = stx->stx_mode;
+    sb->st_ino = stx->stx_ino;
+    sb->st_nlink = stx->stx_nlink;
+    sb->st_uid = stx->stx_uid;
+    sb->st_gid = stx->stx_gid;
+    sb->st_size = stx->stx_size;
+    sb->st_blocks = stx->stx_blocks;
+    sb->st_blksize = stx->stx_blksize;
+    sb->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    sb->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    sb->st_atime = stx->stx_atime.tv_sec;
+    ST_ATIMENSEC(sb) = stx->stx_atime.tv_nsec;
+    sb->st_mtime = stx->stx_mtime.tv_sec;
+    ST_MTIMENSEC(sb) = stx->stx_mtime.tv_nsec;
+    sb->st_ctime = stx->stx_ctime.tv_sec;
+    ST_CTIMENSEC(sb) = stx->stx_ctime.tv_nsec;
+}
+#endif
+
+/*
+ * fetches the metadata of name in the directory open as dirfd without
+ * following symbolic links. where statx(2) exists, only the fields
+ * meta_init() settled on are filled in and the rest of sb is zero.
+ * returns 0 on success and -1 with errno set on failure.
+ */
+int
+fetch_meta(int dirfd, const char *name, struct stat *sb)
+{
+    struct timespec start;
+    int rv;
+#ifdef STATX_BASIC_STATS
+    struct statx stx;
+
+    STATS_START(start);
+    rv = statx(dirfd, name, statx_flags, mask, &stx);
+    STATS_CALL(CALL_STAT, start);
+    if (rv == 0) {
+        stat_from_statx(&stx, sb);
+    }
+#else
+    STATS_START(start);
+    rv = fstatat(dirfd, name, sb, AT_SYMLINK_NOFOLLOW);
+    STATS_CALL(CALL_STAT, start);
+#endif
+    return rv;
+}
+
+/*
+ * fetches the metadata of the entries of list one blocking call at a time,
+ * the error of an entry which could not be fetched is stored in errs.
+ */
+static void
+fetch_each(int dirfd, struct dirlist *list, int *errs)
+{
+    size_t i;
+    struct stat sb;
+
+    for (i = 0; i < list->nents; i++) {
+        if (fetch_meta(dirfd, list->ents[i].name, &sb) < 0) {
+            errs[i] = errno;
+        } else {
+            set_meta(list, i, &sb);
+        }
+    }
+}
+
+static void *
+fetch_worker(void *arg)
+{
+    struct fetchjob *job = arg;
+    size_t i, end, n = job->list->nents;
+    struct stat sb;
+
+    while ((i = __atomic_fetch_add(&job->next, META_CHUNK,
+        __ATOMIC_RELAXED)) < n) {
+        end = i + META_CHUNK < n ? i + META_CHUNK : n;
+        for (; i < end; i++) {
+            /* every entry has slots of its own in the list and in errs */
+            if (fetch_meta(job->dirfd, job->list->ents[i].name, &sb) < 0) {
+                job->errs[i] = errno;
+            } else {
+                set_meta(job->list, i, &sb);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * fetches the metadata of the entries of list with nthreads threads
+ * calling fstatat(2) or statx(2) on the same directory fd, the calling
+ * thread being one of them. with a file system slow to answer, the calls
+ * overlap rather than wait on each other. if a thread cannot be created,
+ * the others take on its share.
+ */
+static void
+fetch_threads(int dirfd, struct dirlist *list, int *errs)
+{
+    pthread_t threads[MAX_WORKERS];
+    int started[MAX_WORKERS];
+    int i;
+    struct fetchjob job;
+
+    job.dirfd = dirfd;
+    job.list = list;
+    job.errs = errs;
+    job.next = 0;
+
+    for (i = 1; i < nthreads; i++) {
+        started[i] = pthread_create(&threads[i], NULL, fetch_worker,
+            &job) == 0;
+    }
+    (void)fetch_worker(&job);
+    for (i = 1; i < nthreads; i++) {
+        if (started[i]) {
+            (void)pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+#ifdef META_URING
+/*
+ * whether the ring fd supports IORING_OP_STATX. a kernel with io_uring but
+ * without it fails every request with EINVAL, and one too old to be probed
+ * predates it.
+ */
+static int
+uring_statx(int fd)
+{
+    struct io_uring_probe *probe;
+    int ok;
+
+    probe = calloc(1, sizeof(*probe)
+        + URING_PROBE_OPS * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        (void)fprintf(stderr, "ls: calloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+        URING_PROBE_OPS) == 0 && probe->last_op >= IORING_OP_STATX
+        && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+static void
+uring_unmap(void)
+{
+    if (ring.sqes != NULL && ring.sqes != MAP_FAILED) {
+        (void)munmap(ring.sqes, ring.sqes_sz);
+    }
+    if (ring.cq_ring != NULL && ring.cq_ring != MAP_FAILED
+        && ring.cq_ring != ring.sq_ring) {
+        (void)munmap(ring.cq_ring, ring.cq_ring_sz);
+    }
+    if (ring.sq_ring != NULL && ring.sq_ring != MAP_FAILED) {
+        (void)munmap(ring.sq_ring, ring.sq_ring_sz);
+    }
+    free(ring.bufs);
+    free(ring.slots);
+    free(ring.sent);
+    (void)close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+/*
+ * submits the statx(2) call of every entry through the ring, keeping up to
+ * depth of them in flight. the error of an entry which could not be fetched
+ * is stored in errs.
+ */
+static void
+uring_fetch(int dirfd, struct dirlist *list, int *errs)
+{
+    size_t next = 0, done = 0, i;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct stat sb;
+    unsigned int head, tail, slot, inflight = 0;
+
+    while (done < list->nents) {
+        tail = *ring.sq_tail;
+        while (next < list->nents && inflight < ring.depth) {
+            slot = ring.slots[--ring.nslots];
+            sqe = &ring.sqes[tail & *ring.sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (unsigned long)list->ents[next].name;
+            sqe->len = mask;
+            sqe->off = (unsigned long)&ring.bufs[slot];
+            sqe->statx_flags = statx_flags;
+            /* the slot fits in the low bits, see MAX_URING_DEPTH */
+            sqe->user_data = (unsigned long long)next << 16 | slot;
+            STATS_START(ring.sent[slot]);
+            ring.sq_array[tail & *ring.sq_mask] = tail & *ring.sq_mask;
+            tail++;
+            next++;
+            inflight++;
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        /* submit whatever the kernel has not consumed yet, and wait for at
+         * least one completion */
+        head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+        STATS_COUNT(CALL_URING);
+        if (syscall(__NR_io_uring_enter, ring.fd, tail - head, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+            (void)fprintf(stderr, "ls: io_uring_enter: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &ring.cqes[head & *ring.cq_mask];
+            i = (size_t)(cqe->user_data >> 16);
+            slot = (unsigned int)(cqe->user_data & 0xffff);
+            STATS_CALL(CALL_STAT, ring.sent[slot]);
+
+            if (cqe->res < 0) {
+                errs[i] = -cqe->res;
+            } else {
+                stat_from_statx(&ring.bufs[slot], &sb);
+                set_meta(list, i, &sb);
+            }
+            ring.slots[ring.nslots++] = slot;
+            head++;
+            inflight--;
+            done++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+#endif
+
+/*
+ * sets up the io_uring(7) engine with the given queue depth, so the
+ * metadata of a directory is fetched in batches rather than one blocking
+ * call at a time. returns -1 if io_uring is unavailable or cannot fetch
+ * metadata, in which case fetch_dirlist() keeps fetching one entry at a
+ * time.
+ */
+int
+meta_uring(int depth)
+{
+#ifdef META_URING
+    struct io_uring_params params;
+    int single;
+    long fd;
+    unsigned int i;
+
+    memset(&params, 0, sizeof(params));
+    if ((fd = syscall(__NR_io_uring_setup, depth, &params)) < 0) {
+        return -1;
+    }
+    if (!uring_statx((int)fd)) {
+        (void)close((int)fd);
+        return -1;
+    }
+    ring.fd = (int)fd;
+    ring.depth = depth;
+
+    ring.sq_ring_sz = params.sq_off.array
+        + params.sq_entries * sizeof(unsigned int);
+    ring.cq_ring_sz = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* newer kernels map both rings with a single call */
+    single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring.cq_ring_sz > ring.sq_ring_sz) {
+        ring.sq_ring_sz = ring.cq_ring_sz;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        uring_unmap();
+        return -1;
+    }
+    if (single) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    }
+    ring.sqes = mmap(NULL, ring.sqes_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.cq_ring == MAP_FAILED || ring.sqes == MAP_FAILED) {
+        uring_unmap();
+        return -1;
+    }
+
+    ring.sq_head = (unsigned int *)((char *)ring.sq_ring + params.sq_off.head);
+    ring.sq_tail = (unsigned int *)((char *)ring.sq_ring + params.sq_off.tail);
+    ring.sq_mask = (unsigned int *)((char *)ring.sq_ring
+        + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned int *)((char *)ring.sq_ring
+        + params.sq_off.array);
+    ring.cq_head = (unsigned int *)((char *)ring.cq_ring + params.cq_off.head);
+    ring.cq_tail = (unsigned int *)((char *)ring.cq_ring + params.cq_off.tail);
+    ring.cq_mask = (unsigned int *)((char *)ring.cq_ring
+        + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)((char *)ring.cq_ring
+        + params.cq_off.cqes);
+
+    if ((ring.bufs = calloc(depth, sizeof(*ring.bufs))) == NULL
+        || (ring.slots = calloc(depth, sizeof(*ring.slots))) == NULL
+        || (ring.sent = calloc(depth, sizeof(*ring.sent))) == NULL) {
+        (void)fprintf(stderr, "ls: calloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < (unsigned int)depth; i++) {
+        ring.slots[ring.nslots++] = i;
+    }
+    return 0;
+#else
+    (void)depth;
+    return -1;
+#endif
+}
+
+/*
+ * has the entries of directories with at least META_PAR_MIN of them
+ * fetched by n threads at once, unless io_uring is in use.
+ */
+void
+meta_threads(int n)
+{
+    nthreads = n;
+}
+
+/*
+ * fetches the metadata of every entry of list, the directory open as dirfd.
+ * entries which cannot be fetched are reported and dropped from the list,
+ * as is every entry if there is no room to fetch them into.
+ */
+void
+fetch_dirlist(int dirfd, struct dirlist *list)
+{
+    int *errs, phase;
+    size_t i, n;
+
+    if (list->nents == 0) {
+        return;
+    }
+    if (alloc_meta(list, meta_flags) < 0) {
+        return;
+    }
+    if ((errs = calloc(list->nents, sizeof(*errs))) == NULL) {
+        fail("calloc");
+        list->nents = 0;
+        return;
+    }
+    phase = STATS_ENTER(PHASE_STAT);
+
+#ifdef META_URING
+    if (ring.fd >= 0) {
+        uring_fetch(dirfd, list, errs);
+    } else if (nthreads > 1 && list->nents >= META_PAR_MIN) {
+        fetch_threads(dirfd, list, errs);
+    } else {
+        fetch_each(dirfd, list, errs);
+    }
+#else
+    if (nthreads > 1 && list->nents >= META_PAR_MIN) {
+        fetch_threads(dirfd, list, errs);
+    } else {
+        fetch_each(dirfd, list, errs);
+    }
+#endif
+    STATS_LEAVE(phase);
+
+    /* the errors are reported in list order, whatever order the calls
+     * completed in */
+    for (i = n = 0; i < list->nents; i++) {
+        if (errs[i] != 0) {
+            (void)fprintf(stderr, "ls: %s: %s\n", list->ents[i].name,
+                strerror(errs[i]));
+            continue;
+        }
+        list->ents[n++] = list->ents[i];
+    }
+    list->nents = n;
+    free(errs);
+}
+
+void
+free_meta(void)
+{
+#ifdef META_URING
+    if (ring.fd >= 0) {
+        uring_unmap();
+    }
+#endif
+}
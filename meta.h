@@ -0,0 +1,25 @@
+#ifndef _META_H_
+#define _META_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dirlist.h"
+
+/* the slot of a request is kept in 16 bits of its user data */
+#define MAX_URING_DEPTH 4096
+
+/* directories with fewer entries are fetched by a single thread */
+#define META_PAR_MIN 1024
+
+/* the entries a fetching thread claims at once */
+#define META_CHUNK 64
+
+void meta_init(int, int);
+int meta_uring(int);
+void meta_threads(int);
+int fetch_meta(int, const char *, struct stat *);
+void fetch_dirlist(int, struct dirlist *);
+void free_meta(void);
+
+#endif
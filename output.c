@@ -0,0 +1,439 @@
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "stats.h"
+#include "utils.h"
+
+/* enough for the decimal digits of any 64 bit integer and its sign */
+#define NUMBUF_SZ 24
+
+/* memory sinks start out with this much room and double when full */
+#define SINK_INIT_SZ 4096
+
+/*
+ * all standard output is appended to this buffer and written out with a
+ * single write(2) when it fills up or at the end of each directory.
+ */
+static char outbuf[OUT_BUF_SZ];
+static struct outsink stdsink = { outbuf, 0, sizeof(outbuf) };
+static int outfd = STDOUT_FILENO;
+
+/* if set, flush after every line as a terminal would expect */
+static int linebuf;
+
+/*
+ * the sink output of the calling thread currently goes to, NULL means
+ * standard output. threads of a parallel traversal each render into their
+ * own sink.
+ */
+static __thread struct outsink *capture;
+
+#define SINK() (capture != NULL ? capture : &stdsink)
+
+/*
+ * under --pipeline, standard output is filled into one of a ring of
+ * buffers while a writer thread writes out those filled before it, in
+ * order, so the traversal goes on while a slow reader catches up. queued
+ * buffers follow head, the one stdsink fills comes after them. once every
+ * buffer is queued, filling waits for the writer. err is the errno of a
+ * write which failed, nothing is written after it.
+ */
+struct outring {
+    char *bufs[MAX_PIPELINE];
+    size_t lens[MAX_PIPELINE];
+    int nbufs;
+    int head;
+    int queued;
+    int err;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;      /* a buffer was queued or written out */
+};
+
+static struct outring ring;
+
+/*
+ * sets up the output sink for the given file descriptor, like stdio, output
+ * to a terminal is flushed line by line.
+ */
+void
+out_init(int fd)
+{
+    outfd = fd;
+    stdsink.len = 0;
+    linebuf = isatty(fd);
+}
+
+/*
+ * sends the output of the calling thread to the given sink until it is
+ * called again with NULL.
+ */
+void
+out_capture(struct outsink *sink)
+{
+    capture = sink;
+}
+
+void
+out_sink_free(struct outsink *sink)
+{
+    free(sink->buf);
+    memset(sink, 0, sizeof(*sink));
+}
+
+/*
+ * writes out buflen bytes of buf followed by len bytes of extra, either
+ * may be empty. partial writes and interruptions are retried.
+ */
+static int
+write_all(const char *buf, size_t buflen, const char *extra, size_t len)
+{
+    struct iovec iov[2];
+    ssize_t n;
+    int iovcnt = 0, phase;
+
+    if (buflen > 0) {
+        iov[iovcnt].iov_base = (void *)buf;
+        iov[iovcnt].iov_len = buflen;
+        iovcnt++;
+    }
+    if (len > 0) {
+        iov[iovcnt].iov_base = (void *)extra;
+        iov[iovcnt].iov_len = len;
+        iovcnt++;
+    }
+
+    phase = STATS_ENTER(PHASE_WRITE);
+    while (iovcnt > 0) {
+        STATS_COUNT(CALL_WRITE);
+        if ((n = writev(outfd, iov, iovcnt)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            STATS_LEAVE(phase);
+            return -1;
+        }
+        STATS_BYTES(n);
+
+        /* drop whatever has been written from the front of the vector */
+        while (iovcnt > 0 && (size_t)n >= iov[0].iov_len) {
+            n -= iov[0].iov_len;
+            iov[0] = iov[1];
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov[0].iov_base = (char *)iov[0].iov_base + n;
+            iov[0].iov_len -= n;
+        }
+    }
+    STATS_LEAVE(phase);
+    return 0;
+}
+
+static void *
+writer_main(void *arg)
+{
+    int i, rv;
+
+    (void)arg;
+    (void)pthread_mutex_lock(&ring.lock);
+    for (;;) {
+        while (ring.queued == 0) {
+            (void)pthread_cond_wait(&ring.cv, &ring.lock);
+        }
+        i = ring.head;
+        (void)pthread_mutex_unlock(&ring.lock);
+
+        rv = ring.err == 0 ? write_all(ring.bufs[i], ring.lens[i], NULL, 0)
+            : 0;
+
+        (void)pthread_mutex_lock(&ring.lock);
+        if (rv < 0) {
+            ring.err = errno;
+        }
+        ring.head = (i + 1) % ring.nbufs;
+        ring.queued--;
+        (void)pthread_cond_broadcast(&ring.cv);
+    }
+    /* NOTREACHED */
+    return NULL;
+}
+
+/*
+ * has standard output written by a thread of its own, through a ring of
+ * nbufs buffers. output to a terminal is written line by line anyway.
+ */
+void
+out_pipeline(int nbufs)
+{
+    pthread_t thread;
+    int i;
+
+    if (linebuf || nbufs < 2) {
+        return;
+    }
+
+    ring.bufs[0] = outbuf;
+    for (i = 1; i < nbufs; i++) {
+        if ((ring.bufs[i] = malloc(OUT_BUF_SZ)) == NULL) {
+            (void)fprintf(stderr, "ls: malloc: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((errno = pthread_mutex_init(&ring.lock, NULL)) != 0
+        || (errno = pthread_cond_init(&ring.cv, NULL)) != 0
+        || (errno = pthread_create(&thread, NULL, writer_main, NULL)) != 0) {
+        (void)fprintf(stderr, "ls: pthread_create: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    (void)pthread_detach(thread);
+
+    /* stdsink goes on filling the first buffer */
+    ring.nbufs = nbufs;
+}
+
+/*
+ * queues the buffer stdsink filled for the writer and has it fill the next
+ * one, once it has been written out. returns -1 with errno set if a write
+ * failed.
+ */
+static int
+queue_buffer(void)
+{
+    int i, rv = 0;
+
+    (void)pthread_mutex_lock(&ring.lock);
+    i = (ring.head + ring.queued) % ring.nbufs;
+    ring.lens[i] = stdsink.len;
+    ring.queued++;
+    (void)pthread_cond_broadcast(&ring.cv);
+
+    while (ring.queued == ring.nbufs) {
+        (void)pthread_cond_wait(&ring.cv, &ring.lock);
+    }
+    if (ring.err != 0) {
+        errno = ring.err;
+        rv = -1;
+    }
+    (void)pthread_mutex_unlock(&ring.lock);
+
+    stdsink.buf = ring.bufs[(i + 1) % ring.nbufs];
+    stdsink.len = 0;
+    return rv;
+}
+
+/*
+ * waits until the writer has written out every buffer queued. returns -1
+ * with errno set if a write failed.
+ */
+static int
+drain_ring(void)
+{
+    int rv = 0;
+
+    (void)pthread_mutex_lock(&ring.lock);
+    while (ring.queued > 0) {
+        (void)pthread_cond_wait(&ring.cv, &ring.lock);
+    }
+    if (ring.err != 0) {
+        errno = ring.err;
+        rv = -1;
+    }
+    (void)pthread_mutex_unlock(&ring.lock);
+    return rv;
+}
+
+/*
+ * writes out what stdsink holds followed by len bytes of extra, or has it
+ * written under --pipeline. returns 0 on success and -1 with errno set if
+ * the write failed.
+ */
+static int
+flush_sink(const char *extra, size_t len)
+{
+    if (ring.nbufs == 0) {
+        if (write_all(stdsink.buf, stdsink.len, extra, len) < 0) {
+            return -1;
+        }
+        stdsink.len = 0;
+        return 0;
+    }
+
+    if (stdsink.len > 0 && queue_buffer() < 0) {
+        return -1;
+    }
+    /* too large for a buffer, written once everything before it is */
+    if (len > 0 && (drain_ring() < 0 || write_all(NULL, 0, extra, len) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * writes out everything buffered so far. returns 0 on success and -1 with
+ * errno set if the write failed.
+ */
+int
+out_flush(void)
+{
+    if (flush_sink(NULL, 0) < 0) {
+        return -1;
+    }
+    return ring.nbufs > 0 ? drain_ring() : 0;
+}
+
+/*
+ * flushes stdsink, what it held is dropped if it could not be written.
+ */
+static void
+flush_or_fail(const char *extra, size_t len)
+{
+    if (flush_sink(extra, len) < 0) {
+        fail("write");
+        stdsink.len = 0;
+    }
+}
+
+/*
+ * makes room for at least len more bytes in a memory sink. returns -1 if
+ * there is no room for them.
+ */
+static int
+grow_sink(struct outsink *sink, size_t len)
+{
+    char *buf;
+    size_t cap = sink->cap ? sink->cap : SINK_INIT_SZ;
+
+    while (cap - sink->len < len) {
+        cap *= 2;
+    }
+
+    if ((buf = realloc(sink->buf, cap)) == NULL) {
+        fail("realloc");
+        return -1;
+    }
+    sink->buf = buf;
+    sink->cap = cap;
+    return 0;
+}
+
+void
+out_write(const char *s, size_t len)
+{
+    struct outsink *sink = SINK();
+
+    if (len <= sink->cap - sink->len) {
+        memcpy(sink->buf + sink->len, s, len);
+        sink->len += len;
+        return;
+    }
+
+    if (sink != &stdsink) {
+        if (grow_sink(sink, len) == 0) {
+            memcpy(sink->buf + sink->len, s, len);
+            sink->len += len;
+        }
+    } else if (len >= sink->cap) {
+        /* too large to ever be buffered, send it along with the buffer */
+        flush_or_fail(s, len);
+    } else {
+        flush_or_fail(NULL, 0);
+        memcpy(sink->buf, s, len);
+        sink->len = len;
+    }
+}
+
+void
+out_str(const char *s)
+{
+    out_write(s, strlen(s));
+}
+
+void
+out_char(char c)
+{
+    struct outsink *sink = SINK();
+
+    if (sink->len == sink->cap) {
+        if (sink != &stdsink) {
+            if (grow_sink(sink, 1) < 0) {
+                return;
+            }
+        } else {
+            flush_or_fail(NULL, 0);
+        }
+    }
+    sink->buf[sink->len++] = c;
+}
+
+void
+out_uint(unsigned long long n)
+{
+    char buf[NUMBUF_SZ];
+    char *p = buf + sizeof(buf);
+
+    /* digits are generated from the least significant one backwards */
+    do {
+        *--p = '0' + (char)(n % 10);
+        n /= 10;
+    } while (n > 0);
+
+    out_write(p, buf + sizeof(buf) - p);
+}
+
+void
+out_int(long long n)
+{
+    if (n < 0) {
+        out_char('-');
+        /* negate in unsigned arithmetic so the smallest value works too */
+        out_uint(-(unsigned long long)n);
+    } else {
+        out_uint((unsigned long long)n);
+    }
+}
+
+/*
+ * ends a line of output, the buffer is only written out here when output
+ * goes to a terminal.
+ */
+void
+out_endline(void)
+{
+    out_char('\n');
+    if (linebuf && capture == NULL) {
+        flush_or_fail(NULL, 0);
+    }
+}
+
+/*
+ * marks the end of a directory listing, everything buffered so far is
+ * written out so that long traversals produce output as they go. captured
+ * output stays in its sink. under --pipeline it is only queued if the
+ * writer has nothing left to write, otherwise the buffer fills up first.
+ */
+void
+out_boundary(void)
+{
+    int idle;
+
+    if (capture != NULL) {
+        return;
+    }
+    if (ring.nbufs > 0) {
+        (void)pthread_mutex_lock(&ring.lock);
+        idle = ring.queued == 0;
+        (void)pthread_mutex_unlock(&ring.lock);
+        if (!idle || stdsink.len == 0) {
+            return;
+        }
+    }
+    flush_or_fail(NULL, 0);
+}
@@ -0,0 +1,35 @@
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stddef.h>
+
+/* size of the buffer all of the listing is collected in before a write(2) */
+#define OUT_BUF_SZ (1024 * 1024)
+
+/* the most buffers --pipeline may fill ahead of the writer */
+#define MAX_PIPELINE 64
+
+/*
+ * a buffer output is appended to. standard output has its own, other sinks
+ * start out zeroed and grow in memory until they are freed.
+ */
+struct outsink {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+void out_init(int);
+void out_capture(struct outsink *);
+void out_sink_free(struct outsink *);
+void out_write(const char *, size_t);
+void out_str(const char *);
+void out_char(char);
+void out_int(long long);
+void out_uint(unsigned long long);
+void out_boundary(void);
+void out_endline(void);
+int out_flush(void);
+void out_pipeline(int);
+
+#endif
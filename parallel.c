@@ -0,0 +1,1009 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmp.h"
+#include "dirlist.h"
+#include "du.h"
+#include "flags.h"
+#include "ls.h"
+#include "match.h"
+#include "meta.h"
+#include "output.h"
+#include "parallel.h"
+#include "print.h"
+#include "stats.h"
+#include "utils.h"
+
+/*
+ * a directory to be listed by one of the workers. the listing is rendered
+ * into out, and the directories below it are attached as children so the
+ * main thread can write everything out in the order fts(3) would visit it.
+ * skip is set for a directory which turned out to be one of its ancestors.
+ * a directory is opened relative to its parent, by name, which keeps fd
+ * open until the last of its children has been opened.
+ *
+ * under --du a directory is only done once everything below it is: the
+ * subtree of a child adds to sum, and to the entry idx of the child in
+ * list, as it is finished. unfinished counts the children which are not,
+ * and the directory itself until it has been read. listed sums up the
+ * entries which are listed, for the total, a counted child adds its
+ * subtree to it too. a quiet directory is summed up but not listed, its fd
+ * is closed like any other and its list is not kept. under -d every directory is quiet, and an operand is listed
+ * as an entry of its own once it is done, by sb with the sums added.
+ */
+struct dirtask {
+    char *path;
+    const char *name;
+    int fd;
+    size_t unopened;
+    int level;
+    int is_dir;
+    dev_t dev;
+    ino_t ino;
+    struct dirtask *parent;
+    struct dirtask **children;
+    size_t nchildren;
+    struct outsink out;
+    int done;
+    int skip;
+    int quiet;
+    unsigned int idx;
+    struct dirlist list;
+    struct dusum sum;
+    struct dusum listed;
+    int counted;
+    size_t unfinished;
+    struct stat *sb;
+};
+
+/*
+ * the tasks of one worker. the owner takes the most recently pushed task
+ * from the tail, idle workers steal the oldest one from the head, which is
+ * usually the root of the largest remaining subtree.
+ */
+struct deque {
+    pthread_mutex_t lock;
+    struct dirtask **tasks;
+    size_t head;
+    size_t tail;
+    size_t cap;
+};
+
+struct pool {
+    struct deque *deques;
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;     /* tasks were queued or everything is done */
+    pthread_cond_t done_cv;     /* a task has been listed */
+    size_t queued;              /* tasks sitting in one of the deques */
+    size_t pending;             /* tasks which have not been listed yet */
+    size_t held;                /* bytes listed but not written out yet */
+    struct dirtask *wanted;     /* the task written out next, or last */
+    unsigned long gen;          /* bumped whenever work_cv is signalled */
+    int flags;
+    int options;
+    cmp_func compar;
+};
+
+struct worker {
+    struct pool *pool;
+    int id;
+    int started;
+    pthread_t thread;
+};
+
+/*
+ * returns a task for the directory path, or NULL if there is no room for
+ * it.
+ */
+static struct dirtask *
+new_task(char *path, int level, struct dirtask *parent, const struct stat *sb)
+{
+    struct dirtask *task;
+
+    if ((task = malloc(sizeof(*task))) == NULL) {
+        fail("malloc");
+        return NULL;
+    }
+    memset(task, 0, sizeof(*task));
+    task->path = path;
+    task->fd = -1;
+    task->level = level;
+    task->parent = parent;
+    task->unfinished = 1;
+    if (sb != NULL) {
+        task->is_dir = 1;
+        task->dev = sb->st_dev;
+        task->ino = sb->st_ino;
+    }
+    return task;
+}
+
+/*
+ * checks whether the directory is one of the ancestors of task, fts(3)
+ * reports those as FTS_DC and does not descend into them.
+ */
+static int
+is_cycle(const struct dirtask *task, const struct stat *sb)
+{
+    for (; task != NULL; task = task->parent) {
+        if (task->is_dir && task->dev == sb->st_dev && task->ino == sb->st_ino) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+free_task(struct dirtask *task)
+{
+    out_sink_free(&task->out);
+    free(task->sb);
+    free(task->children);
+    free(task->path);
+    free(task);
+}
+
+/*
+ * makes room for n more tasks at the tail of the deque, before they are
+ * counted as pending. only its owner pushes to a deque, the others only
+ * ever take from it, so the room stays until they are pushed. returns -1
+ * if there is none.
+ */
+static int
+reserve_tasks(struct deque *dq, size_t n)
+{
+    struct dirtask **tasks;
+    size_t cap;
+    int rv = 0;
+
+    (void)pthread_mutex_lock(&dq->lock);
+    /* reuse the room stolen tasks have left at the head first */
+    if (dq->cap - dq->tail < n && dq->head > 0) {
+        memmove(dq->tasks, dq->tasks + dq->head,
+            (dq->tail - dq->head) * sizeof(*tasks));
+        dq->tail -= dq->head;
+        dq->head = 0;
+    }
+    if (dq->cap - dq->tail < n) {
+        cap = dq->cap ? dq->cap * 2 : 64;
+        while (cap - dq->tail < n) {
+            cap *= 2;
+        }
+        if ((tasks = realloc(dq->tasks, cap * sizeof(*tasks))) == NULL) {
+            fail("realloc");
+            rv = -1;
+        } else {
+            dq->tasks = tasks;
+            dq->cap = cap;
+        }
+    }
+    (void)pthread_mutex_unlock(&dq->lock);
+    return rv;
+}
+
+static void
+push_task(struct deque *dq, struct dirtask *task)
+{
+    (void)pthread_mutex_lock(&dq->lock);
+    dq->tasks[dq->tail++] = task;
+    (void)pthread_mutex_unlock(&dq->lock);
+}
+
+/*
+ * takes a task from the tail of the deque if own is set, or steals one from
+ * its head otherwise. returns NULL if the deque is empty.
+ */
+static struct dirtask *
+take_from(struct deque *dq, int own)
+{
+    struct dirtask *task = NULL;
+
+    (void)pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        if (own) {
+            task = dq->tasks[--dq->tail];
+        } else {
+            task = dq->tasks[dq->head++];
+        }
+        if (dq->head == dq->tail) {
+            dq->head = dq->tail = 0;
+        }
+    }
+    (void)pthread_mutex_unlock(&dq->lock);
+
+    return task;
+}
+
+static int
+in_subtree(const struct dirtask *task, const struct dirtask *root)
+{
+    for (; task != NULL; task = task->parent) {
+        if (task == root) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * takes the first task queued below the one the main thread writes out
+ * next, or that task itself, out of whichever deque it is in. returns NULL
+ * if there is none. called with the pool locked.
+ */
+static struct dirtask *
+take_wanted(struct pool *pool)
+{
+    struct deque *dq;
+    struct dirtask *task = NULL;
+    size_t k;
+    int i;
+
+    for (i = 0; task == NULL && i < pool->nworkers; i++) {
+        dq = &pool->deques[i];
+        (void)pthread_mutex_lock(&dq->lock);
+        for (k = dq->head; k < dq->tail; k++) {
+            if (in_subtree(dq->tasks[k], pool->wanted)) {
+                task = dq->tasks[k];
+                memmove(dq->tasks + k, dq->tasks + k + 1,
+                    (dq->tail - k - 1) * sizeof(*dq->tasks));
+                if (--dq->tail == dq->head) {
+                    dq->head = dq->tail = 0;
+                }
+                break;
+            }
+        }
+        (void)pthread_mutex_unlock(&dq->lock);
+    }
+
+    if (task != NULL) {
+        pool->queued--;
+    }
+    return task;
+}
+
+/*
+ * takes the next task to list. once more than PAR_HELD_MAX bytes of output
+ * are waiting to be written out, only what the main thread waits for is
+ * listed, which is what lets it write out the rest: a slow directory
+ * early on would otherwise have the whole tree after it held in memory.
+ */
+static struct dirtask *
+take_task(struct pool *pool, int id)
+{
+    struct dirtask *task;
+    int i;
+
+    (void)pthread_mutex_lock(&pool->lock);
+    if (pool->held > PAR_HELD_MAX) {
+        task = take_wanted(pool);
+        (void)pthread_mutex_unlock(&pool->lock);
+        return task;
+    }
+    (void)pthread_mutex_unlock(&pool->lock);
+
+    task = take_from(&pool->deques[id], 1);
+    for (i = 1; task == NULL && i < pool->nworkers; i++) {
+        task = take_from(&pool->deques[(id + i) % pool->nworkers], 0);
+    }
+
+    if (task != NULL) {
+        (void)pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        (void)pthread_mutex_unlock(&pool->lock);
+    }
+    return task;
+}
+
+/*
+ * queues a task for every directory among the entries of list which the
+ * serial traversal would descend into. those there is no room for are
+ * left out.
+ */
+static void
+add_children(struct pool *pool, int id, struct dirtask *task,
+    const struct dirlist *list)
+{
+    const struct dirname *ent;
+    size_t i, n = 0;
+    struct dirtask *child;
+    char *path;
+
+    for (i = 0; i < list->nents; i++) {
+        ent = &list->ents[i];
+        if (ent->type == DT_DIR && !is_dots(ent->name)
+            && !((pool->flags & FLAG_match) && match_pruned(ent->name))) {
+            n++;
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+
+    if ((task->children = malloc(n * sizeof(*task->children))) == NULL) {
+        fail("malloc");
+        return;
+    }
+    for (i = 0; i < list->nents; i++) {
+        ent = &list->ents[i];
+        if (ent->type == DT_DIR && !is_dots(ent->name)
+            && !((pool->flags & FLAG_match) && match_pruned(ent->name))) {
+            if ((path = make_path(task->path, ent->name)) == NULL) {
+                continue;
+            }
+            if ((child = new_task(path, task->level + 1, task, NULL)) == NULL) {
+                free(path);
+                continue;
+            }
+            child->name = child->path + strlen(child->path)
+                - strlen(ent->name);
+            /* its device and inode are only known once it is opened */
+            child->is_dir = 1;
+            child->idx = ent->idx;
+            /* like traverse(), -R does not list hidden directories, but
+             * --du still counts what is in them */
+            child->quiet = task->quiet || !(pool->flags & FLAG_R)
+                || (!(pool->flags & (FLAG_A | FLAG_a))
+                && is_hidden(ent->name));
+            child->counted = (pool->flags & FLAG_du) && !task->quiet
+                && is_listed(ent->name, ent->type, pool->flags);
+            task->children[task->nchildren++] = child;
+        }
+    }
+
+    n = task->nchildren;
+    if (n > 0 && reserve_tasks(&pool->deques[id], n) < 0) {
+        for (i = 0; i < n; i++) {
+            free_task(task->children[i]);
+        }
+        n = task->nchildren = 0;
+    }
+    if (n == 0) {
+        free(task->children);
+        task->children = NULL;
+        return;
+    }
+    task->unopened = n;
+
+    /* count the children as pending before their parent is marked done */
+    (void)pthread_mutex_lock(&pool->lock);
+    pool->pending += n;
+    task->unfinished += n;
+    (void)pthread_mutex_unlock(&pool->lock);
+
+    /* pushed in reverse, so the owner continues with the first child */
+    for (i = n; i > 0; i--) {
+        push_task(&pool->deques[id], task->children[i - 1]);
+    }
+
+    (void)pthread_mutex_lock(&pool->lock);
+    pool->queued += n;
+    pool->gen++;
+    (void)pthread_cond_broadcast(&pool->work_cv);
+    (void)pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * closes the directory of task once the last of its children has been
+ * opened.
+ */
+static void
+release_dir(struct pool *pool, struct dirtask *task)
+{
+    int last;
+
+    (void)pthread_mutex_lock(&pool->lock);
+    last = --task->unopened == 0;
+    (void)pthread_mutex_unlock(&pool->lock);
+
+    /* under --du, a directory still to be listed needs it for that */
+    if (last && ((pool->flags & FLAG_du) == 0 || task->quiet)) {
+        (void)close(task->fd);
+    }
+}
+
+/*
+ * puts the children of task in the order its list was sorted in, which is
+ * the order they are written out in. those which are not listed go last.
+ * they are left as they are if there is no room to sort them in.
+ */
+static void
+sort_children(struct dirtask *task)
+{
+    size_t i, n, nlisted, *rank;
+    unsigned int maxidx = 0;
+    struct dirtask **slots;
+
+    if (task->nchildren == 0) {
+        return;
+    }
+    for (i = 0; i < task->nchildren; i++) {
+        if (task->children[i]->idx > maxidx) {
+            maxidx = task->children[i]->idx;
+        }
+    }
+
+    /* where the entry of each child ended up, if it is listed */
+    nlisted = task->list.nents;
+    rank = malloc((maxidx + 1) * sizeof(*rank));
+    slots = malloc((nlisted + task->nchildren) * sizeof(*slots));
+    if (rank == NULL || slots == NULL) {
+        fail("malloc");
+        free(rank);
+        free(slots);
+        return;
+    }
+    for (i = 0; i <= maxidx; i++) {
+        rank[i] = nlisted;
+    }
+    for (i = 0; i < nlisted; i++) {
+        if (task->list.ents[i].idx <= maxidx) {
+            rank[task->list.ents[i].idx] = i;
+        }
+    }
+
+    memset(slots, 0, (nlisted + task->nchildren) * sizeof(*slots));
+    n = nlisted;
+    for (i = 0; i < task->nchildren; i++) {
+        if (rank[task->children[i]->idx] < nlisted) {
+            slots[rank[task->children[i]->idx]] = task->children[i];
+        } else {
+            slots[n++] = task->children[i];
+        }
+    }
+
+    for (i = n = 0; i < nlisted + task->nchildren; i++) {
+        if (slots[i] != NULL) {
+            task->children[n++] = slots[i];
+        }
+    }
+    free(slots);
+    free(rank);
+}
+
+/*
+ * lists the directory of task under --du into its output sink, with the
+ * sums of the subtrees below it.
+ */
+static void
+render_task(struct pool *pool, struct dirtask *task)
+{
+    blkcnt_t blocks, total;
+    off_t size;
+    unsigned long long files;
+    int flags = pool->flags;
+
+    out_capture(&task->out);
+    if ((task->level > 0 || ((flags & FLAG_headers) && !(flags & FLAG_R)))
+        && !(flags & FLAGS_RECORD)) {
+        out_str(task->path);
+        out_char(':');
+        out_endline();
+    }
+    /* by now every one of its children has been opened */
+    if (task->fd >= 0) {
+        du_total(&task->listed, &blocks, &size, &files);
+        total = (flags & FLAG_h) ? (blkcnt_t)size : blocks;
+        list_du(task->fd, task->path, &task->list, flags, total);
+        sort_children(task);
+        (void)close(task->fd);
+    }
+    out_capture(NULL);
+}
+
+/*
+ * drops the hold the directory of task has on itself, or one of its
+ * children has on it, under --du. the last one finishes it: it is listed
+ * and its sum is added to its parent, which may finish in turn.
+ */
+static void
+finish_task(struct pool *pool, struct dirtask *task)
+{
+    blkcnt_t blocks;
+    off_t size;
+    unsigned long long files;
+    struct dirtask *parent;
+    struct dirmeta *meta;
+
+    (void)pthread_mutex_lock(&pool->lock);
+    while (task != NULL && --task->unfinished == 0) {
+        (void)pthread_mutex_unlock(&pool->lock);
+
+        if (!task->quiet && !task->skip) {
+            render_task(pool, task);
+        }
+        free_dirlist(&task->list);
+        parent = task->parent;
+        if (parent != NULL || task->sb != NULL) {
+            du_total(&task->sum, &blocks, &size, &files);
+        }
+        if (task->sb != NULL) {
+            task->sb->st_blocks += blocks;
+            task->sb->st_size += size;
+            out_capture(&task->out);
+            print_subtree(AT_FDCWD, task->path, NULL, task->sb, files + 1);
+            out_capture(NULL);
+        }
+
+        (void)pthread_mutex_lock(&pool->lock);
+        if (parent != NULL && !parent->quiet && !task->skip) {
+            /* the children of a listed directory finish one at a time */
+            meta = &parent->list.meta;
+            meta->blocks[task->idx] += blocks;
+            meta->size[task->idx] += size;
+            meta->files[task->idx] += files;
+        }
+        if (parent != NULL && task->counted) {
+            du_merge(&parent->listed, &task->sum);
+        }
+        if (parent != NULL) {
+            du_merge(&parent->sum, &task->sum);
+        }
+        du_free(&task->sum);
+        du_free(&task->listed);
+        pool->held += task->out.len;
+        task->done = 1;
+        (void)pthread_cond_broadcast(&pool->done_cv);
+        task = parent;
+    }
+    (void)pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * reads every entry of the directory of task under --du, hidden or not,
+ * and sums up those which are not directories. the entries to be listed
+ * are only picked once the sums of its directories are known.
+ */
+static void
+read_task(struct pool *pool, int id, struct dirtask *task)
+{
+    const struct dirname *ent;
+    size_t i, n;
+    struct stat sb;
+
+    if (read_dirlist(task->fd, &task->list) < 0) {
+        (void)fprintf(stderr, "ls: %s: %s\n", task->path, strerror(errno));
+        (void)close(task->fd);
+        task->fd = -1;
+        return;
+    }
+
+    /* what --exclude drops is neither fetched nor counted */
+    if (pool->flags & FLAG_match) {
+        for (i = n = 0; i < task->list.nents; i++) {
+            if (!match_excluded(task->list.ents[i].name)) {
+                task->list.ents[n++] = task->list.ents[i];
+            }
+        }
+        task->list.nents = n;
+    }
+    fetch_dirlist(task->fd, &task->list);
+
+    for (i = 0; i < task->list.nents; i++) {
+        ent = &task->list.ents[i];
+        get_meta(&task->list, ent->idx, &sb);
+        task->list.ents[i].type = IFTODT(sb.st_mode);
+        if (!is_dots(ent->name)) {
+            du_add(&task->sum, task->dev, &sb);
+        }
+        /* the total only adds up what is listed, "." and ".." included */
+        if (!task->quiet && is_listed(ent->name, ent->type, pool->flags)) {
+            du_add(&task->listed, task->dev, &sb);
+        }
+    }
+
+    add_children(pool, id, task, &task->list);
+
+    /* otherwise the last child to be opened closes it */
+    if (task->quiet) {
+        free_dirlist(&task->list);
+        if (task->nchildren == 0) {
+            (void)close(task->fd);
+        }
+    }
+}
+
+/*
+ * lists a single directory into the output sink of its task, exactly as
+ * traverse() would print it.
+ */
+static void
+list_task(struct pool *pool, int id, struct dirtask *task)
+{
+    int fd, oflags = O_RDONLY | O_DIRECTORY, rv;
+    struct dirlist list;
+    struct stat sb;
+    struct timespec start;
+
+    /* like traverse(), a directory below the roots is never followed */
+    if (task->level > 0) {
+        oflags |= O_NOFOLLOW;
+    }
+    STATS_COUNT(CALL_OPEN);
+    if (task->parent == NULL) {
+        fd = open(task->path, oflags);
+    } else {
+        fd = openat(task->parent->fd, task->name, oflags);
+        release_dir(pool, task->parent);
+    }
+
+    if (fd >= 0 && task->level > 0) {
+        STATS_START(start);
+        rv = fstat(fd, &sb);
+        STATS_CALL(CALL_STAT, start);
+
+        /* like fts(3), never descend into a directory above this one */
+        if (rv < 0 || is_cycle(task->parent, &sb)) {
+            task->skip = 1;
+            (void)close(fd);
+            return;
+        }
+        task->dev = sb.st_dev;
+        task->ino = sb.st_ino;
+    }
+
+    /* a quiet directory which cannot be read is reported all the same,
+     * what it holds is missing from the sums */
+    if (pool->flags & FLAG_du) {
+        if ((task->fd = fd) < 0) {
+            (void)fprintf(stderr, "ls: %s: %s\n", task->path,
+                strerror(errno));
+        } else {
+            read_task(pool, id, task);
+        }
+        return;
+    }
+
+    out_capture(&task->out);
+    if (task->level > 0 && !(pool->flags & FLAGS_RECORD)) {
+        out_str(task->path);
+        out_char(':');
+        out_endline();
+    }
+
+    if (fd < 0) {
+        (void)fprintf(stderr, "ls: %s: %s\n", task->path, strerror(errno));
+    } else {
+        memset(&list, 0, sizeof(list));
+        task->fd = fd;
+        if (list_dir(fd, task->path, &list, pool->flags) == 0) {
+            add_children(pool, id, task, &list);
+        }
+        free_dirlist(&list);
+
+        /* otherwise the last child to be opened closes it */
+        if (task->nchildren == 0) {
+            (void)close(fd);
+        }
+    }
+    out_capture(NULL);
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct pool *pool = w->pool;
+    struct dirtask *task;
+    unsigned long gen;
+
+    for (;;) {
+        /* whatever happens after this wakes the worker up again */
+        (void)pthread_mutex_lock(&pool->lock);
+        gen = pool->gen;
+        (void)pthread_mutex_unlock(&pool->lock);
+
+        if ((task = take_task(pool, w->id)) == NULL) {
+            (void)pthread_mutex_lock(&pool->lock);
+            while (pool->gen == gen && pool->pending > 0) {
+                (void)pthread_cond_wait(&pool->work_cv, &pool->lock);
+            }
+            if (pool->pending == 0) {
+                (void)pthread_mutex_unlock(&pool->lock);
+                break;
+            }
+            (void)pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        list_task(pool, w->id, task);
+        if (pool->flags & FLAG_du) {
+            finish_task(pool, task);
+        }
+
+        (void)pthread_mutex_lock(&pool->lock);
+        if (!(pool->flags & FLAG_du)) {
+            pool->held += task->out.len;
+            task->done = 1;
+        }
+        if (--pool->pending == 0) {
+            pool->gen++;
+            (void)pthread_cond_broadcast(&pool->work_cv);
+        }
+        (void)pthread_cond_broadcast(&pool->done_cv);
+        (void)pthread_mutex_unlock(&pool->lock);
+    }
+
+    free_dirbuf();
+    return NULL;
+}
+
+/*
+ * writes out the listing of task and then of everything below it, in the
+ * pre-order fts(3) uses, waiting for the workers where necessary.
+ */
+static void
+emit_task(struct pool *pool, struct dirtask *task, int *num_headers)
+{
+    size_t i, len;
+
+    /* the workers held back by the output waiting list what is below */
+    (void)pthread_mutex_lock(&pool->lock);
+    pool->wanted = task;
+    if (pool->held > PAR_HELD_MAX) {
+        pool->gen++;
+        (void)pthread_cond_broadcast(&pool->work_cv);
+    }
+    while (!task->done) {
+        (void)pthread_cond_wait(&pool->done_cv, &pool->lock);
+    }
+    (void)pthread_mutex_unlock(&pool->lock);
+
+    /* like traverse(), every directory but the first is set apart */
+    if (task->is_dir && !task->skip && !task->quiet
+        && !(pool->flags & FLAGS_RECORD) && (*num_headers)++ > 0) {
+        out_endline();
+    }
+    if (task->out.len > 0) {
+        out_write(task->out.buf, task->out.len);
+    }
+    out_boundary();
+    len = task->out.len;
+    out_sink_free(&task->out);
+
+    (void)pthread_mutex_lock(&pool->lock);
+    if (pool->held > PAR_HELD_MAX) {
+        pool->gen++;
+        (void)pthread_cond_broadcast(&pool->work_cv);
+    }
+    pool->held -= len;
+    (void)pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < task->nchildren; i++) {
+        emit_task(pool, task->children[i], num_headers);
+    }
+    free_task(task);
+}
+
+/*
+ * returns a task for the operand path, a directory if sb is set, or NULL
+ * if there is no room for it.
+ */
+static struct dirtask *
+new_root(const char *path, const struct stat *sb)
+{
+    struct dirtask *task;
+    char *copy;
+
+    if ((copy = strdup(path)) == NULL) {
+        fail("strdup");
+        return NULL;
+    }
+    if ((task = new_task(copy, 0, NULL, sb)) == NULL) {
+        free(copy);
+    }
+    return task;
+}
+
+/*
+ * keeps a copy of sb, the metadata of the operand of task, to list it by
+ * under -d. returns -1 if there is no room for it.
+ */
+static int
+keep_stat(struct dirtask *task, const struct stat *sb)
+{
+    if ((task->sb = malloc(sizeof(*sb))) == NULL) {
+        fail("malloc");
+        return -1;
+    }
+    *task->sb = *sb;
+    task->quiet = 1;
+    return 0;
+}
+
+static void
+free_pool(struct pool *pool)
+{
+    int j;
+
+    for (j = 0; j < pool->nworkers; j++) {
+        (void)pthread_mutex_destroy(&pool->deques[j].lock);
+        free(pool->deques[j].tasks);
+    }
+    (void)pthread_mutex_destroy(&pool->lock);
+    (void)pthread_cond_destroy(&pool->work_cv);
+    (void)pthread_cond_destroy(&pool->done_cv);
+    free(pool->deques);
+}
+
+/*
+ * lists the nroots tasks of roots with nworkers threads and writes them
+ * out, each task is freed once it has been. as many threads as could be
+ * started list them. returns -1, with none of them written out or freed,
+ * if none could.
+ */
+static int
+run_pool(struct pool *pool, struct dirtask **roots, size_t nroots,
+    int nworkers)
+{
+    struct worker *workers;
+    size_t i;
+    int j, nstarted = 0, num_headers = 0;
+
+    workers = malloc(nworkers * sizeof(*workers));
+    pool->deques = malloc(nworkers * sizeof(*pool->deques));
+    if (workers == NULL || pool->deques == NULL) {
+        fail("malloc");
+        free(workers);
+        free(pool->deques);
+        return -1;
+    }
+    if ((errno = pthread_mutex_init(&pool->lock, NULL)) != 0
+        || (errno = pthread_cond_init(&pool->work_cv, NULL)) != 0
+        || (errno = pthread_cond_init(&pool->done_cv, NULL)) != 0) {
+        fail("pthread_init");
+        free(workers);
+        free(pool->deques);
+        return -1;
+    }
+    for (j = 0; j < nworkers; j++) {
+        memset(&pool->deques[j], 0, sizeof(pool->deques[j]));
+        if ((errno = pthread_mutex_init(&pool->deques[j].lock, NULL)) != 0) {
+            fail("pthread_mutex_init");
+            break;
+        }
+        pool->nworkers++;
+    }
+    if (pool->nworkers < nworkers
+        || reserve_tasks(&pool->deques[0], nroots) < 0) {
+        free_pool(pool);
+        free(workers);
+        return -1;
+    }
+
+    /* all roots start out with the first worker, the others steal them */
+    for (i = nroots; i > 0; i--) {
+        if (!roots[i - 1]->done) {
+            push_task(&pool->deques[0], roots[i - 1]);
+            pool->queued++;
+            pool->pending++;
+        }
+    }
+
+    /* a worker which cannot be started leaves its deque empty */
+    for (j = 0; j < nworkers; j++) {
+        workers[j].pool = pool;
+        workers[j].id = j;
+        workers[j].started = (errno = pthread_create(&workers[j].thread,
+            NULL, worker_main, &workers[j])) == 0;
+        nstarted += workers[j].started;
+    }
+    if (nstarted == 0) {
+        fail("pthread_create");
+        free_pool(pool);
+        free(workers);
+        return -1;
+    }
+
+    for (i = 0; i < nroots; i++) {
+        emit_task(pool, roots[i], &num_headers);
+    }
+
+    for (j = 0; j < nworkers; j++) {
+        if (workers[j].started) {
+            (void)pthread_join(workers[j].thread, NULL);
+        }
+    }
+    /* only now no worker can still be trying to steal from a deque */
+    free_pool(pool);
+    free(workers);
+    return 0;
+}
+
+/*
+ * traverses the given paths recursively like traverse() does under -R, but
+ * lists the directories with nworkers threads. the output is identical to
+ * that of traverse().
+ */
+void
+traverse_parallel(char *paths[], int flags, int nworkers)
+{
+    FTS *fts;
+    FTSENT *entry;
+    struct dirtask **roots = NULL, **grown, *task;
+    struct pool pool;
+    size_t i, nroots = 0, cap = 0;
+    int info;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.flags = flags;
+    pool.compar = get_compar(flags);
+    /* the workers share the working directory, so fts must not chdir(2) */
+    pool.options = FTS_WHITEOUT | FTS_PHYSICAL | FTS_NOCHDIR;
+    if (flags & FLAG_a) {
+        pool.options |= FTS_SEEDOT;
+    }
+
+    /* the roots are read the same way traverse() does, so they are sorted
+     * the same way too, but none of them are descended into here */
+    if ((fts = fts_open(paths, pool.options, pool.compar)) == NULL) {
+        fail("fts_open");
+        return;
+    }
+
+    while ((entry = fts_read(fts))) {
+        info = entry->fts_info;
+        if (entry->fts_level != 0 || info == FTS_DP) {
+            continue;
+        }
+
+        if (info == FTS_DNR || info == FTS_ERR) {
+            (void)fprintf(stderr, "ls: fts_read: %s\n", strerror(errno));
+        }
+
+        if (info == FTS_D) {
+            task = new_root(entry->fts_path, entry->fts_statp);
+            if (fts_set(fts, entry, FTS_SKIP) < 0) {
+                fail("fts_set");
+            }
+            if (task != NULL && (flags & FLAG_d)
+                && keep_stat(task, entry->fts_statp) < 0) {
+                free_task(task);
+                task = NULL;
+            }
+        } else if ((task = new_root(entry->fts_path, NULL)) != NULL) {
+            /* anything else is printed right away, as a finished task */
+            out_capture(&task->out);
+            print_file(AT_FDCWD, entry->fts_path, NULL, entry->fts_statp);
+            out_capture(NULL);
+            pool.held += task->out.len;
+            task->done = 1;
+        }
+        if (task == NULL) {
+            continue;
+        }
+
+        if (nroots == cap) {
+            cap = cap ? cap * 2 : 16;
+            if ((grown = realloc(roots, cap * sizeof(*roots))) == NULL) {
+                fail("realloc");
+                free_task(task);
+                cap = nroots;
+                continue;
+            }
+            roots = grown;
+        }
+        roots[nroots++] = task;
+    }
+
+    if (nroots > 0 && run_pool(&pool, roots, nroots, nworkers) < 0) {
+        for (i = 0; i < nroots; i++) {
+            free_task(roots[i]);
+        }
+    }
+    free(roots);
+
+    if (fts_close(fts) < 0) {
+        fail("fts_close");
+    }
+}
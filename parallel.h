@@ -0,0 +1,13 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+/* upper bound for the number of threads -P accepts */
+#define MAX_WORKERS 256
+
+/* the most output of listed directories held for the main thread to write
+ * out in order, before the workers only list what it is waiting for */
+#define PAR_HELD_MAX (64 * 1024 * 1024)
+
+void traverse_parallel(char *[], int, int);
+
+#endif
@@ -1,20 +1,69 @@
 #include <ctype.h>
 #include <errno.h>
-#include <grp.h>
 #include <limits.h>
-#include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "flags.h"
+#include "idcache.h"
+#include "lsdir.h"
+#include "output.h"
 #include "print.h"
+#include "stats.h"
+#include "timefmt.h"
 #include "utils.h"
 
 /* Maximum buffer sizes used for formatted string. */
-#define TIMEBUF_SZ 64
-#define MODESTR_SZ 11 /* e.g. "drwxr-xr-x" + NUL */
+#define MODESTR_SZ 12 /* e.g. "drwxr-xr-x " + NUL, see strmode(3) */
+
+/*
+ * a --format binary stream starts with a header of BINARY_HDR_SZ bytes:
+ * the magic, the version and the size of a record as 16 bit integers and
+ * which time the records carry as a 32 bit one. all integers are little
+ * endian. every record is BINARY_REC_SZ bytes of fields, laid out as
+ * print_binary() writes them, followed by its path and link target.
+ */
+#define BINARY_MAGIC "lsrecord"
+#define BINARY_VERSION 1
+#define BINARY_HDR_SZ 16
+#define BINARY_REC_SZ 72
+
+/* room for the numeric fields of a record and their keys, each of them
+ * has at most 20 digits and a sign */
+#define NUMBUF_SZ 24
+#define FIELDS_SZ 512
+
+/* the time a record carries, the one -c and -u select */
+#define TIME_MODIFY 0
+#define TIME_ACCESS 1
+#define TIME_CHANGE 2
+
+/* the fields every record format writes out of an entry */
+struct record {
+    const char *dir;
+    size_t dirlen;
+    const char *name;
+    const struct stat *sb;
+    time_t sec;
+    long nsec;
+    const char *target;
+    size_t targetlen;
+    unsigned long long files;
+};
+
+/* the number of 512 byte blocks in a BLOCKSIZE block, set by print_init() */
+static long blk_ratio = 1;
+
+/* the function lsdir_walk() hands the entries to, under FLAG_call */
+static lsdir_func entry_func;
+static void *entry_arg;
+
+static void print_entry(int, const char *, const char *, const struct stat *,
+    unsigned long long);
+static void record_entry(int, const char *, const char *,
+    const struct stat *, unsigned long long, int);
 
 void
 humanize(off_t bytes)
@@ -24,139 +73,760 @@ humanize(off_t bytes)
 
     if (humanize_number(buf, sizeof(buf), bytes, "", HN_AUTOSCALE,
         HN_B | HN_DECIMAL | HN_NOSPACE) < 0) {
-            fprintf(stderr, "ls: humanize_number: %s\n", strerror(errno));
-            exit(EXIT_FAILURE);
+            fail("humanize_number");
+            return;
     }
 
-    printf("%s", buf);
+    out_str(buf);
 }
 
+/*
+ * prints the "total" line of a directory listing, total is either a number
+ * of 512 byte blocks or, if -h is set, a number of bytes. the blocks are
+ * printed in units of KB under -k and of BLOCKSIZE otherwise.
+ */
 void
-print_file(char *file, char *path, const struct stat *sb, int flags)
+print_total(blkcnt_t total, int flags)
+{
+    /* records stand on their own, there is nothing to add them up into */
+    if (flags & FLAGS_RECORD) {
+        return;
+    }
+
+    out_str("total ");
+    if (flags & FLAG_h) {
+        humanize(total);
+    } else if (flags & FLAG_k) {
+        /* 512 byte blocks are half a KB */
+        out_int(total / 2);
+    } else {
+        /* rounded up, part of a block takes a whole one */
+        out_int((total + blk_ratio - 1) / blk_ratio);
+    }
+    out_endline();
+}
+
+/*
+ * prints a file name with its non-printable characters shown as '?',
+ * which is what happens unless -w is set. the name itself is left
+ * untouched, it may still be needed to descend into the file.
+ */
+static void
+print_name(const char *file)
+{
+    const char *start;
+
+    while (*file != '\0') {
+        /* write out runs of printable characters at once */
+        for (start = file; *file != '\0' && isprint((unsigned char)*file);
+            file++) {
+            continue;
+        }
+        out_write(start, file - start);
+
+        if (*file != '\0') {
+            out_char('?');
+            file++;
+        }
+    }
+}
+
+/*
+ * reads the target of the symbolic link file, in the directory open as fd,
+ * into buf. path, the directory's, is only used to report an error, it is
+ * NULL if file is named by itself. returns the length of the target, or
+ * -1 once the error has been reported.
+ */
+static ssize_t
+read_link(int fd, const char *file, const char *path, char *buf, size_t size)
+{
+    ssize_t len;
+
+    STATS_COUNT(CALL_READLINK);
+    if ((len = readlinkat(fd, file, buf, size)) < 0) {
+        (void)fprintf(stderr, "ls: readlink: %s%s%s: %s\n",
+            path != NULL ? path : "", path != NULL ? "/" : "", file,
+            strerror(errno));
+    }
+    return len;
+}
+
+/*
+ * an entry as it is handed to the fields of the plan.
+ */
+struct entry {
+    int fd;
+    const char *file;
+    const char *path;
+    const struct stat *sb;
+    unsigned long long files;
+};
+
+typedef void (*field_func)(const struct entry *);
+
+/* the most fields a plan has: the file count, inode and blocks, the six
+ * fields of a long listing before the name, the name, its indicator, the
+ * link target and the end of the line */
+#define PLAN_MAX 16
+
+/*
+ * what an entry is printed as, worked out by print_init() from the flags
+ * once, so that nothing but the entry itself is looked at per entry.
+ */
+static field_func plan[PLAN_MAX];
+static size_t nplan;
+static int plan_flags;
+
+static void
+field_files(const struct entry *ent)
+{
+    out_uint(ent->files);
+    out_char(' ');
+}
+
+static void
+field_ino(const struct entry *ent)
+{
+    out_uint(ent->sb->st_ino);
+    out_char(' ');
+}
+
+static void
+field_blocks(const struct entry *ent)
+{
+    /* rounded up, part of a block takes a whole one */
+    out_int((ent->sb->st_blocks + blk_ratio - 1) / blk_ratio);
+    out_char(' ');
+}
+
+static void
+field_blocks_k(const struct entry *ent)
+{
+    /* st_blocks are in units of 512 bytes, which is half a KB */
+    out_int(ent->sb->st_blocks / 2);
+    out_char(' ');
+}
+
+static void
+field_blocks_h(const struct entry *ent)
+{
+    humanize(ent->sb->st_size);
+    out_char(' ');
+}
+
+static void
+field_mode(const struct entry *ent)
+{
+    char modes[MODESTR_SZ];
+
+    strmode(ent->sb->st_mode, modes);
+    out_str(modes);
+    out_char(' ');
+    out_int((long)ent->sb->st_nlink);
+    out_char(' ');
+}
+
+static void
+field_owner(const struct entry *ent)
+{
+    const char *owner = user_name(ent->sb->st_uid);
+
+    if (owner == NULL) {
+        out_uint(ent->sb->st_uid);
+    } else {
+        out_str(owner);
+    }
+    out_char(' ');
+}
+
+static void
+field_group(const struct entry *ent)
+{
+    const char *group = group_name(ent->sb->st_gid);
+
+    if (group == NULL) {
+        out_uint(ent->sb->st_gid);
+    } else {
+        out_str(group);
+    }
+    out_char(' ');
+}
+
+static void
+field_ids(const struct entry *ent)
+{
+    out_uint(ent->sb->st_uid);
+    out_char(' ');
+    out_uint(ent->sb->st_gid);
+    out_char(' ');
+}
+
+static void
+field_size(const struct entry *ent)
+{
+    if (S_ISCHR(ent->sb->st_mode)) {
+        out_uint(major(ent->sb->st_rdev));
+        out_str(", ");
+        out_uint(minor(ent->sb->st_rdev));
+    } else {
+        out_int(ent->sb->st_size);
+    }
+    out_char(' ');
+}
+
+static void
+field_size_h(const struct entry *ent)
+{
+    if (S_ISCHR(ent->sb->st_mode)) {
+        out_uint(major(ent->sb->st_rdev));
+        out_str(", ");
+        out_uint(minor(ent->sb->st_rdev));
+    } else {
+        humanize(ent->sb->st_size);
+    }
+    out_char(' ');
+}
+
+static void
+field_mtime(const struct entry *ent)
+{
+    out_str(format_time(ent->sb->st_mtime));
+    out_char(' ');
+}
+
+static void
+field_atime(const struct entry *ent)
+{
+    out_str(format_time(ent->sb->st_atime));
+    out_char(' ');
+}
+
+static void
+field_ctime(const struct entry *ent)
+{
+    out_str(format_time(ent->sb->st_ctime));
+    out_char(' ');
+}
+
+static void
+field_name(const struct entry *ent)
+{
+    out_str(ent->file);
+}
+
+static void
+field_name_q(const struct entry *ent)
+{
+    print_name(ent->file);
+}
+
+static void
+field_indicator(const struct entry *ent)
+{
+    print_indicator(ent->sb);
+}
+
+static void
+field_target(const struct entry *ent)
+{
+    char target[PATH_MAX];
+    ssize_t len;
+
+    if (S_ISLNK(ent->sb->st_mode) && (len = read_link(ent->fd, ent->file,
+        ent->path, target, sizeof(target))) >= 0) {
+        out_str(" -> ");
+        out_write(target, len);
+    }
+}
+
+static void
+field_endline(const struct entry *ent)
+{
+    (void)ent;
+    out_endline();
+}
+
+static void
+field_record(const struct entry *ent)
+{
+    record_entry(ent->fd, ent->file, ent->path, ent->sb, ent->files,
+        plan_flags);
+}
+
+static void
+add_field(field_func field)
+{
+    plan[nplan++] = field;
+}
+
+/*
+ * works out the plan every entry is printed by from the flags, they are
+ * not looked at again for an entry. it has to be called once they are
+ * final, before anything is printed.
+ */
+void
+print_init(int flags)
+{
+    long blk_size;
+
+    plan_flags = flags;
+    nplan = 0;
+
+    if (flags & FLAGS_RECORD) {
+        add_field(field_record);
+        return;
+    }
+
+    if (flags & FLAG_du) {
+        add_field(field_files);
+    }
+    if (flags & FLAG_i) {
+        add_field(field_ino);
+    }
+    if ((flags & FLAG_s) && (flags & FLAG_h)) {
+        add_field(field_blocks_h);
+    } else if ((flags & FLAG_s) && (flags & FLAG_k)) {
+        add_field(field_blocks_k);
+    } else if (flags & FLAG_s) {
+        add_field(field_blocks);
+    }
+
+    /* BLOCKSIZE is only looked up here, not for every entry or total */
+    if ((flags & (FLAG_s | FLAG_l)) && !(flags & (FLAG_h | FLAG_k))) {
+        (void)getbsize(NULL, &blk_size);
+        blk_ratio = blk_size / STAT_BLK_SIZE;
+    }
+
+    if (flags & FLAG_l) {
+        add_field(field_mode);
+        if (flags & FLAG_n) {
+            add_field(field_ids);
+        } else {
+            add_field(field_owner);
+            add_field(field_group);
+        }
+        add_field((flags & FLAG_h) ? field_size_h : field_size);
+        if (flags & FLAG_c) {
+            add_field(field_ctime);
+        } else if (flags & FLAG_u) {
+            add_field(field_atime);
+        } else {
+            add_field(field_mtime);
+        }
+    }
+
+    add_field((flags & FLAG_w) ? field_name : field_name_q);
+    if (flags & FLAG_F) {
+        add_field(field_indicator);
+    }
+    if (flags & FLAG_l) {
+        add_field(field_target);
+    }
+    add_field(field_endline);
+}
+
+/*
+ * prints file, an entry of the directory path open as fd, the way the
+ * flags given to print_init() ask for. an operand is printed with a NULL
+ * path, file is then its path relative to fd.
+ */
+void
+print_file(int fd, const char *file, const char *path, const struct stat *sb)
+{
+    print_entry(fd, file, path, sb, 1);
+}
+
+/*
+ * like print_file(), for an entry under --du whose subtree holds files
+ * files, itself included. sb has the sums of the subtree.
+ */
+void
+print_subtree(int fd, const char *file, const char *path,
+    const struct stat *sb, unsigned long long files)
+{
+    print_entry(fd, file, path, sb, files);
+}
+
+static void
+print_entry(int fd, const char *file, const char *path,
+    const struct stat *sb, unsigned long long files)
 {
-    long blks;
     size_t i;
+    struct entry ent;
 
     if (sb == NULL) {
         fprintf(stderr, "ls: %s: %s\n", file, strerror(errno));
         return;
     }
+    STATS_ENTRY();
 
-    if (flags & FLAG_i) {
-        printf("%ld ", sb->st_ino);
+    ent.fd = fd;
+    ent.file = file;
+    ent.path = path;
+    ent.sb = sb;
+    ent.files = files;
+    for (i = 0; i < nplan; i++) {
+        plan[i](&ent);
     }
+}
 
-    if (flags & FLAG_s) {
-        blks = get_file_blk_size(sb);
-        if (flags & FLAG_h) {
-            humanize(sb->st_size);
-            printf(" ");
-        } else {
-            if (flags & FLAG_k) {
-                /* st_blocks are in units of 512 bytes, which is half a KB */
-                blks = sb->st_blocks / 2;
-            } 
-            printf("%ld ", blks);
+/*
+ * returns the length of the UTF-8 sequence which starts at p, before end,
+ * or 0 if it is not a valid one. overlong forms, surrogates and what lies
+ * beyond U+10FFFF are not.
+ */
+static size_t
+utf8_len(const char *p, const char *end)
+{
+    const unsigned char *s = (const unsigned char *)p;
+    unsigned char lo = 0x80, hi = 0xbf;
+    size_t i, n;
+
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        lo = s[0] == 0xe0 ? 0xa0 : lo;
+        hi = s[0] == 0xed ? 0x9f : hi;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        lo = s[0] == 0xf0 ? 0x90 : lo;
+        hi = s[0] == 0xf4 ? 0x8f : hi;
+    } else {
+        return 0;
+    }
+
+    if ((size_t)(end - p) < n || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (i = 2; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
         }
     }
+    return n;
+}
 
-    if (!(flags & FLAG_w)) {
-        /* remove non-printable characters */
-        for (i = 0; i < strlen(file); i++) {
-            if (!isprint((int)file[i])) {
-                file[i] = '?';
+/*
+ * writes s out as the inside of a JSON string. names are not necessarily
+ * UTF-8: a byte which is not part of a valid sequence is written as the
+ * code point of the same value, \u0080 to \u00ff, so only nul and binary
+ * records give back the exact bytes of every name.
+ */
+static void
+json_write(const char *s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char esc[6] = { '\\', 'u', '0', '0' };
+    const char *end = s + len, *start;
+    size_t n;
+
+    while (s < end) {
+        /* write out runs of characters which need no escape at once */
+        for (start = s; s < end; s += n) {
+            if ((unsigned char)*s >= 0x80) {
+                n = utf8_len(s, end);
+            } else {
+                n = (unsigned char)*s >= 0x20 && *s != '"' && *s != '\\';
+            }
+            if (n == 0) {
+                break;
             }
         }
+        out_write(start, s - start);
+
+        if (s < end) {
+            if (*s == '"' || *s == '\\') {
+                out_char('\\');
+                out_char(*s);
+            } else {
+                esc[4] = hex[(unsigned char)*s >> 4];
+                esc[5] = hex[*s & 0xf];
+                out_write(esc, sizeof(esc));
+            }
+            s++;
+        }
+    }
+}
+
+/*
+ * appends key and the decimal digits of n at p, returns where they end.
+ * the fields of a record are put together on the stack and written out
+ * at once.
+ */
+static char *
+put_field(char *p, const char *key, long long n)
+{
+    char digits[NUMBUF_SZ], *d = digits + sizeof(digits);
+    size_t len = strlen(key);
+    /* negate in unsigned arithmetic so the smallest value works too */
+    unsigned long long u = n < 0 ? -(unsigned long long)n
+        : (unsigned long long)n;
+
+    memcpy(p, key, len);
+    p += len;
+
+    do {
+        *--d = '0' + (char)(u % 10);
+        u /= 10;
+    } while (u > 0);
+    if (n < 0) {
+        *--d = '-';
     }
 
-    if (flags & FLAG_l) {
-        print_file_long(file, path, sb, flags);
+    len = digits + sizeof(digits) - d;
+    memcpy(p, d, len);
+    return p + len;
+}
+
+static void
+print_json(const struct record *rec, int flags)
+{
+    char fields[FIELDS_SZ], *p = fields;
+    const struct stat *sb = rec->sb;
+
+    out_str("{\"path\":\"");
+    if (rec->dir != NULL) {
+        json_write(rec->dir, rec->dirlen);
+        out_char('/');
+    }
+    json_write(rec->name, strlen(rec->name));
+
+    p = put_field(p, "\",\"ino\":", (long long)sb->st_ino);
+    p = put_field(p, ",\"mode\":", (long long)sb->st_mode);
+    p = put_field(p, ",\"nlink\":", (long long)sb->st_nlink);
+    p = put_field(p, ",\"uid\":", (long long)sb->st_uid);
+    p = put_field(p, ",\"gid\":", (long long)sb->st_gid);
+    p = put_field(p, ",\"rdev\":", (long long)sb->st_rdev);
+    p = put_field(p, ",\"size\":", (long long)sb->st_size);
+    p = put_field(p, ",\"blocks\":", (long long)sb->st_blocks);
+    if (flags & FLAG_u) {
+        p = put_field(p, ",\"atime\":", (long long)rec->sec);
+        p = put_field(p, ",\"atime_nsec\":", rec->nsec);
+    } else if (flags & FLAG_c) {
+        p = put_field(p, ",\"ctime\":", (long long)rec->sec);
+        p = put_field(p, ",\"ctime_nsec\":", rec->nsec);
     } else {
-        printf("%s", file);
-        if (flags & FLAG_F) {
-            print_indicator(sb);
-        }
+        p = put_field(p, ",\"mtime\":", (long long)rec->sec);
+        p = put_field(p, ",\"mtime_nsec\":", rec->nsec);
+    }
+    if (flags & FLAG_du) {
+        p = put_field(p, ",\"files\":", (long long)rec->files);
     }
+    out_write(fields, p - fields);
 
-    printf("\n");
+    if (S_ISLNK(sb->st_mode)) {
+        out_str(",\"target\":\"");
+        json_write(rec->target, rec->targetlen);
+        out_char('"');
+    }
+    out_char('}');
+    out_endline();
 }
 
-void
-print_file_long(char *file, char *path, const struct stat *sb, int flags)
+/*
+ * a record is twelve fields, each followed by a NUL: the path, the inode,
+ * mode, link count, uid, gid, device, size, blocks, the time in seconds
+ * and its nanoseconds, and the link target, which is empty for anything
+ * but a symbolic link.
+ */
+static void
+print_nul(const struct record *rec)
 {
-    char modes[MODESTR_SZ];
-    char timebuf[TIMEBUF_SZ];
-    const char *group, *owner;
-    long nlink = (long)sb->st_nlink;
-    struct passwd *pw;
-    struct group *gr;
-    struct tm tm;
-    time_t time = sb->st_mtime;
+    char fields[FIELDS_SZ], *p = fields;
+    const struct stat *sb = rec->sb;
+    long long values[10];
+    int i;
 
-    strmode(sb->st_mode, modes);
+    if (rec->dir != NULL) {
+        out_write(rec->dir, rec->dirlen);
+        out_char('/');
+    }
+    out_str(rec->name);
+    out_char('\0');
+
+    values[0] = (long long)sb->st_ino;
+    values[1] = (long long)sb->st_mode;
+    values[2] = (long long)sb->st_nlink;
+    values[3] = (long long)sb->st_uid;
+    values[4] = (long long)sb->st_gid;
+    values[5] = (long long)sb->st_rdev;
+    values[6] = (long long)sb->st_size;
+    values[7] = (long long)sb->st_blocks;
+    values[8] = (long long)rec->sec;
+    values[9] = rec->nsec;
+    for (i = 0; i < 10; i++) {
+        p = put_field(p, "", values[i]);
+        *p++ = '\0';
+    }
+    out_write(fields, p - fields);
 
-    pw = getpwuid(sb->st_uid);
-    owner = pw ? pw->pw_name : NULL;
+    out_write(rec->target, rec->targetlen);
+    out_char('\0');
+}
 
-    gr = getgrgid(sb->st_gid);
-    group = gr ? gr->gr_name : NULL;
+/*
+ * stores the low n bytes of v at p, least significant first.
+ */
+static void
+put_le(unsigned char *p, unsigned long long v, int n)
+{
+    int i;
 
-    if (flags & FLAG_c) {
-        time = sb->st_ctime;
-    } else if (flags & FLAG_u) {
-        time = sb->st_atime;
+    for (i = 0; i < n; i++) {
+        p[i] = (unsigned char)(v & 0xff);
+        v >>= 8;
     }
+}
 
-    if (localtime_r(&time, &tm) == NULL) {
-        memset(&tm, 0, sizeof(tm));
+static void
+print_binary(const struct record *rec)
+{
+    const struct stat *sb = rec->sb;
+    unsigned char buf[BINARY_REC_SZ];
+    size_t namelen = strlen(rec->name);
+
+    if (rec->dir != NULL) {
+        namelen += rec->dirlen + 1;
     }
 
-    if (strftime(timebuf, sizeof(timebuf), "%b %e %H:%M", &tm) == 0) {
-        size_t n = strlcpy(timebuf, "???", sizeof(timebuf));
-        if (n >= sizeof(timebuf)) {
-            (void)fprintf(stderr, "stat: strlcpy: %s\n", strerror(errno));
-            exit(EXIT_FAILURE);
-        }
+    put_le(buf, (unsigned long long)sb->st_ino, 8);
+    put_le(buf + 8, (unsigned long long)sb->st_size, 8);
+    put_le(buf + 16, (unsigned long long)sb->st_blocks, 8);
+    put_le(buf + 24, (unsigned long long)rec->sec, 8);
+    put_le(buf + 32, (unsigned long long)sb->st_rdev, 8);
+    put_le(buf + 40, (unsigned long long)sb->st_nlink, 8);
+    put_le(buf + 48, (unsigned long long)rec->nsec, 4);
+    put_le(buf + 52, (unsigned long long)sb->st_mode, 4);
+    put_le(buf + 56, (unsigned long long)sb->st_uid, 4);
+    put_le(buf + 60, (unsigned long long)sb->st_gid, 4);
+    put_le(buf + 64, (unsigned long long)namelen, 4);
+    put_le(buf + 68, (unsigned long long)rec->targetlen, 4);
+    out_write((const char *)buf, sizeof(buf));
+
+    if (rec->dir != NULL) {
+        out_write(rec->dir, rec->dirlen);
+        out_char('/');
     }
+    out_str(rec->name);
+    out_write(rec->target, rec->targetlen);
+}
 
-    if (owner == NULL || (flags & FLAG_n)) {
-        printf("%s %ld %u ", modes, nlink, (unsigned)sb->st_uid);
-    } else {
-        printf("%s %ld %s ", modes, nlink, owner);
+/*
+ * starts a --format binary stream, before any record.
+ */
+void
+print_binary_header(int flags)
+{
+    unsigned char buf[BINARY_HDR_SZ];
+    int which = TIME_MODIFY;
+
+    if (flags & FLAG_u) {
+        which = TIME_ACCESS;
+    } else if (flags & FLAG_c) {
+        which = TIME_CHANGE;
     }
 
-    if (group == NULL || (flags & FLAG_n)) {
-        printf("%u ", (unsigned)sb->st_gid);
-    } else {
-        printf("%s ", group);
+    memcpy(buf, BINARY_MAGIC, 8);
+    put_le(buf + 8, BINARY_VERSION, 2);
+    put_le(buf + 10, BINARY_REC_SZ, 2);
+    put_le(buf + 12, (unsigned long long)which, 4);
+    out_write((const char *)buf, sizeof(buf));
+}
+
+/*
+ * has the entries handed to func, with arg, rather than printed.
+ */
+void
+print_callback(lsdir_func func, void *arg)
+{
+    entry_func = func;
+    entry_arg = arg;
+}
+
+static void
+call_entry(const struct record *rec)
+{
+    struct lsdir_entry ent;
+
+    ent.dir = rec->dir;
+    ent.name = rec->name;
+    ent.sb = rec->sb;
+    ent.target = rec->targetlen > 0 ? rec->target : NULL;
+    ent.targetlen = rec->targetlen;
+    entry_func(&ent, entry_arg);
+}
+
+/*
+ * prints file, in the directory path open as fd, or named by itself if
+ * path is NULL, as a record of raw fields in the format --format selected,
+ * whatever the plan.
+ * nothing is padded, humanized or localized and names are left as they
+ * are. everything is written straight into the output buffer.
+ */
+void
+print_record(int fd, const char *file, const char *path,
+    const struct stat *sb)
+{
+    if (sb != NULL) {
+        STATS_ENTRY();
+    }
+    record_entry(fd, file, path, sb, 1, plan_flags);
+}
+
+static void
+record_entry(int fd, const char *file, const char *path,
+    const struct stat *sb, unsigned long long files, int flags)
+{
+    char target[PATH_MAX];
+    ssize_t len;
+    struct record rec;
+
+    if (sb == NULL) {
+        fprintf(stderr, "ls: %s: %s\n", file, strerror(errno));
+        return;
+    }
+
+    rec.dir = path;
+    rec.dirlen = 0;
+    if (path != NULL) {
+        /* like make_path(), without doubling a trailing slash */
+        rec.dirlen = strlen(path);
+        if (rec.dirlen > 0 && path[rec.dirlen - 1] == '/') {
+            rec.dirlen--;
+        }
     }
+    rec.name = file;
+    rec.sb = sb;
+    rec.files = files;
 
-    if (S_ISCHR(sb->st_mode)) {
-        printf("%u, %u %s %s", major(sb->st_rdev), minor(sb->st_rdev), 
-            timebuf, file);
-    } else if (flags & FLAG_h) {
-        humanize(sb->st_size);
-        printf(" %s %s", timebuf, file);
+    if (flags & FLAG_u) {
+        rec.sec = sb->st_atime;
+        rec.nsec = ST_ATIMENSEC(sb);
+    } else if (flags & FLAG_c) {
+        rec.sec = sb->st_ctime;
+        rec.nsec = ST_CTIMENSEC(sb);
     } else {
-        printf("%lld %s %s", (long long)sb->st_size, timebuf, file);
+        rec.sec = sb->st_mtime;
+        rec.nsec = ST_MTIMENSEC(sb);
     }
 
-    if (flags & FLAG_F) {
-        print_indicator(sb);
+    /* an entry handed to a function has its target only with -l */
+    rec.target = target;
+    rec.targetlen = 0;
+    if ((flags & FLAG_l) && S_ISLNK(sb->st_mode)
+        && (len = read_link(fd, file, path, target, sizeof(target))) > 0) {
+        rec.targetlen = (size_t)len;
     }
 
-    if (S_ISLNK(sb->st_mode)) {
-        char filename[PATH_MAX], fullpath[PATH_MAX];
-        ssize_t len;
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, file);
-        if ((len = readlink(fullpath, filename, sizeof(filename))) < 0) {
-            (void)fprintf(stderr, "ls: readlink: %s: %s\n", fullpath, strerror(errno));
-            /*exit(EXIT_FAILURE);*/
-            return;
-        } else {
-            filename[len] = '\0';
-        }
-        printf(" -> %s", filename);
+    if (flags & FLAG_call) {
+        call_entry(&rec);
+    } else if (flags & FLAG_binary) {
+        print_binary(&rec);
+    } else if (flags & FLAG_json) {
+        print_json(&rec, flags);
+    } else {
+        print_nul(&rec);
     }
 }
 
@@ -164,26 +834,26 @@ void
 print_indicator(const struct stat *sb)
 {
     if (S_ISDIR(sb->st_mode)) {
-        printf("/");
+        out_char('/');
     }
 
     if (S_ISWHT(sb->st_mode)) {
-        printf("%c", '%');
+        out_char('%');
     }
 
     if (S_ISSOCK(sb->st_mode)) {
-        printf("=");
+        out_char('=');
     }
 
     if (S_ISFIFO(sb->st_mode)) {
-        printf("|");
+        out_char('|');
     }
 
     if (S_ISLNK(sb->st_mode)) {
-        printf("@");
+        out_char('@');
     }
 
     if (S_ISREG(sb->st_mode) && (sb->st_mode & (S_IXUSR |S_IXGRP | S_IXOTH))) {
-        printf("*");
+        out_char('*');
     }
 }
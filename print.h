@@ -3,9 +3,17 @@
 
 #include <sys/stat.h>
 
-void print_file(char *, char *, const struct stat *, int);
-void print_file_long(char *, char *, const struct stat *, int);
+#include "lsdir.h"
+
+void print_init(int);
+void print_file(int, const char *, const char *, const struct stat *);
+void print_subtree(int, const char *, const char *, const struct stat *,
+    unsigned long long);
 void print_indicator(const struct stat *);
+void print_record(int, const char *, const char *, const struct stat *);
+void print_binary_header(int);
+void print_callback(lsdir_func, void *);
+void print_total(blkcnt_t, int);
 void humanize(off_t);
 
 #endif
@@ -0,0 +1,685 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "dirlist.h"
+#include "ls.h"
+#include "meta.h"
+#include "output.h"
+#include "serve.h"
+#include "utils.h"
+
+#ifdef IN_NONBLOCK
+/* the tree is kept up to date from inotify(7) events */
+#define SERVE_INOTIFY
+#endif
+
+/* without inotify, how often the tree is checked for directories which
+ * have changed */
+#define RESCAN_MS 1000
+
+/* "lsrq", the first thing in every request */
+#define REQ_MAGIC 0x6c737271
+
+/* the arguments of a request take up at most this much */
+#define REQ_MAX (1024 * 1024)
+
+/*
+ * what a client sends first, along with its working directory, standard
+ * output and standard error. its arguments follow, each NUL terminated,
+ * len bytes of them.
+ */
+struct reqhdr {
+    unsigned int magic;
+    unsigned int argc;
+    unsigned int len;
+};
+
+/* set in a server process answering a request, conn is its connection */
+int served;
+static int served_conn;
+
+/* the roots the tree was walked from, and the flags it was listed with */
+static char **roots;
+static int tree_flags;
+
+/* the directories above the one walk() puts in the tree */
+struct walked {
+    dev_t dev;
+    ino_t ino;
+    const struct walked *parent;
+};
+
+#ifdef SERVE_INOTIFY
+/* every change to the entries of a directory or to their metadata */
+#define WATCH_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF \
+    | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/* room for a good many events, aligned like them */
+#define EVBUF_SZ (64 * 1024)
+
+/*
+ * a directory of the tree, at the index of its watch descriptor. path is
+ * NULL for descriptors which are not in use. a dirty directory is read
+ * again once every pending event has been seen.
+ */
+struct watch {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    int dirty;
+};
+
+static int ifd = -1;
+static struct watch *watches;
+static size_t nwatches;
+
+/*
+ * starts watching the directory at path, which sb is the metadata of.
+ * returns 1 if it is new to the tree, 0 if it is already in it and -1 if
+ * it cannot be watched.
+ */
+static int
+add_watch(const char *path, const struct stat *sb)
+{
+    int wd;
+    size_t n;
+    struct watch *w;
+
+    if ((wd = inotify_add_watch(ifd, path, WATCH_MASK)) < 0) {
+        (void)fprintf(stderr, "ls: inotify_add_watch: %s: %s\n", path,
+            strerror(errno));
+        return -1;
+    }
+
+    if ((size_t)wd >= nwatches) {
+        n = nwatches ? nwatches : 64;
+        while (n <= (size_t)wd) {
+            n *= 2;
+        }
+        if ((w = realloc(watches, n * sizeof(*w))) == NULL) {
+            (void)fprintf(stderr, "ls: realloc: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        memset(w + nwatches, 0, (n - nwatches) * sizeof(*w));
+        watches = w;
+        nwatches = n;
+    }
+
+    /* the same directory always has the same descriptor */
+    w = &watches[wd];
+    if (w->path != NULL) {
+        return 0;
+    }
+    if ((w->path = strdup(path)) == NULL) {
+        (void)fprintf(stderr, "ls: strdup: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    w->dev = sb->st_dev;
+    w->ino = sb->st_ino;
+    w->dirty = 0;
+    return 1;
+}
+
+/*
+ * drops a directory from the tree, along with everything below it if it
+ * was moved, since their paths no longer lead to them.
+ */
+static void
+forget(size_t wd, int moved)
+{
+    size_t i, len;
+    struct watch *w = &watches[wd];
+
+    if (moved) {
+        len = strlen(w->path);
+        for (i = 0; i < nwatches; i++) {
+            if (i != wd && watches[i].path != NULL
+                && strncmp(watches[i].path, w->path, len) == 0
+                && watches[i].path[len] == '/') {
+                forget(i, 0);
+            }
+        }
+    }
+
+    cache_drop(w->dev, w->ino);
+    (void)inotify_rm_watch(ifd, (int)wd);
+    free(w->path);
+    w->path = NULL;
+}
+#endif
+
+/*
+ * puts the directory at path and everything below it in the tree. only a
+ * root may be a symbolic link.
+ */
+static void
+walk(const char *path, const struct walked *parent)
+{
+    blkcnt_t total;
+    char *subpath;
+    int fd, oflags = O_RDONLY | O_DIRECTORY;
+    size_t i;
+    struct dirlist list;
+    struct dirname *ent;
+    struct stat sb;
+    struct walked self;
+    const struct walked *a;
+
+    if (parent != NULL) {
+        oflags |= O_NOFOLLOW;
+    }
+    if ((fd = open(path, oflags)) < 0) {
+        return;
+    }
+    if (fstat(fd, &sb) < 0) {
+        (void)close(fd);
+        return;
+    }
+
+    /* like fts(3), never descend into a directory above this one */
+    for (a = parent; a != NULL; a = a->parent) {
+        if (a->dev == sb.st_dev && a->ino == sb.st_ino) {
+            (void)close(fd);
+            return;
+        }
+    }
+#ifdef SERVE_INOTIFY
+    /* watched before it is read, so no change can slip in between */
+    if (add_watch(path, &sb) <= 0) {
+        (void)close(fd);
+        return;
+    }
+#endif
+    self.dev = sb.st_dev;
+    self.ino = sb.st_ino;
+    self.parent = parent;
+
+    memset(&list, 0, sizeof(list));
+    if (load_dir(fd, path, &list, tree_flags, &total) == 0) {
+        for (i = 0; i < list.nents; i++) {
+            ent = &list.ents[i];
+            if (ent->type != DT_DIR || is_dots(ent->name)) {
+                continue;
+            }
+            subpath = make_path(path, ent->name);
+            walk(subpath, &self);
+            free(subpath);
+        }
+    }
+
+    free_dirlist(&list);
+    (void)close(fd);
+}
+
+#ifdef SERVE_INOTIFY
+/*
+ * reads the directory of a watch again, and walks any directory which is
+ * new below it.
+ */
+static void
+refresh(size_t wd)
+{
+    blkcnt_t total;
+    char *subpath;
+    int fd;
+    size_t i;
+    struct dirlist list;
+    struct dirname *ent;
+    struct stat sb;
+    struct walked self;
+    struct watch *w = &watches[wd];
+
+    w->dirty = 0;
+    cache_drop(w->dev, w->ino);
+
+    /* its path may lead somewhere else by now */
+    if ((fd = open(w->path, O_RDONLY | O_DIRECTORY)) < 0) {
+        forget(wd, 0);
+        return;
+    }
+    if (fstat(fd, &sb) < 0 || sb.st_dev != w->dev || sb.st_ino != w->ino) {
+        (void)close(fd);
+        forget(wd, 0);
+        return;
+    }
+    self.dev = sb.st_dev;
+    self.ino = sb.st_ino;
+    self.parent = NULL;
+
+    memset(&list, 0, sizeof(list));
+    if (load_dir(fd, w->path, &list, tree_flags, &total) == 0) {
+        for (i = 0; i < list.nents; i++) {
+            ent = &list.ents[i];
+            if (ent->type != DT_DIR || is_dots(ent->name)) {
+                continue;
+            }
+            /* watches may move when a new one is added */
+            subpath = make_path(watches[wd].path, ent->name);
+            walk(subpath, &self);
+            free(subpath);
+        }
+    }
+
+    free_dirlist(&list);
+    (void)close(fd);
+}
+
+/*
+ * handles every event queued so far. the directories they are about are
+ * read again once, however many events there were for each.
+ */
+static void
+drain_events(void)
+{
+    union {
+        struct inotify_event ev;
+        char buf[EVBUF_SZ];
+    } u;
+    const struct inotify_event *ev;
+    char *p;
+    int overflow = 0;
+    size_t i;
+    ssize_t n;
+
+    while ((n = read(ifd, u.buf, sizeof(u.buf))) > 0) {
+        for (p = u.buf; p < u.buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                overflow = 1;
+            } else if (ev->wd < 0 || (size_t)ev->wd >= nwatches
+                || watches[ev->wd].path == NULL) {
+                continue;
+            } else if (ev->mask & (IN_DELETE_SELF | IN_IGNORED
+                | IN_MOVE_SELF)) {
+                forget((size_t)ev->wd, ev->mask & IN_MOVE_SELF);
+            } else {
+                watches[ev->wd].dirty = 1;
+            }
+        }
+    }
+
+    /* events were lost, so anything may have changed */
+    for (i = 0; i < nwatches; i++) {
+        if (watches[i].path != NULL && (overflow || watches[i].dirty)) {
+            refresh(i);
+        }
+    }
+}
+#endif
+
+static int
+read_all(int fd, char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = read(fd, buf, len)) <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * receives a request and the descriptors it came with from conn. returns
+ * the arguments, NULL terminated, or NULL if the request is malformed.
+ */
+static char **
+recv_request(int conn, int fds[3], int *argcp)
+{
+    char *args, **argv, *p;
+    int i;
+    ssize_t n;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    struct msghdr msg;
+    struct reqhdr hdr;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctl;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    if ((n = recvmsg(conn, &msg, 0)) != (ssize_t)sizeof(hdr)
+        || (cmsg = CMSG_FIRSTHDR(&msg)) == NULL
+        || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        return NULL;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    if (hdr.magic != REQ_MAGIC || hdr.argc == 0 || hdr.len > REQ_MAX
+        || hdr.argc > hdr.len) {
+        return NULL;
+    }
+    if ((args = malloc(hdr.len)) == NULL
+        || (argv = calloc(hdr.argc + 1, sizeof(*argv))) == NULL) {
+        (void)fprintf(stderr, "ls: malloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (read_all(conn, args, hdr.len) < 0 || args[hdr.len - 1] != '\0') {
+        return NULL;
+    }
+
+    for (i = 0, p = args; i < (int)hdr.argc; i++) {
+        if (p >= args + hdr.len) {
+            return NULL;
+        }
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    *argcp = (int)hdr.argc;
+    return argv;
+}
+
+/*
+ * on an early exit of a process answering a request, the client still
+ * learns that it failed, once everything listed has been written out.
+ */
+static void
+served_exit(void)
+{
+    char status = EXIT_FAILURE;
+
+    (void)out_flush();
+    (void)write_all(served_conn, &status, 1);
+}
+
+/*
+ * answers the request on conn in a process of its own, which lists from
+ * the tree as it is now. the client's standard output and standard error
+ * are written to directly, and its exit status is sent back at the end.
+ */
+static void
+answer(int lfd, int conn)
+{
+    char **argv, status;
+    int argc, fds[3];
+    pid_t pid;
+
+    if ((pid = fork()) < 0) {
+        (void)fprintf(stderr, "ls: fork: %s\n", strerror(errno));
+        return;
+    } else if (pid > 0) {
+        return;
+    }
+
+    (void)close(lfd);
+#ifdef SERVE_INOTIFY
+    (void)close(ifd);
+#endif
+    (void)signal(SIGCHLD, SIG_DFL);
+    (void)signal(SIGPIPE, SIG_DFL);
+
+    if ((argv = recv_request(conn, fds, &argc)) == NULL
+        || dup2(fds[1], STDOUT_FILENO) < 0 || dup2(fds[2], STDERR_FILENO) < 0
+        || fchdir(fds[0]) < 0) {
+        _exit(EXIT_FAILURE);
+    }
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+    (void)close(fds[2]);
+
+    /* an io_uring(7) ring would be shared with the server */
+    free_meta();
+
+    served = 1;
+    served_conn = conn;
+    if (atexit(served_exit) != 0) {
+        _exit(EXIT_FAILURE);
+    }
+
+    /* run as if from the command line, with the arguments parsed anew */
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optreset = 1;
+    optind = 1;
+#endif
+    status = (char)main(argc, argv);
+
+    free_exit();
+    (void)write_all(conn, &status, 1);
+    _exit(status);
+}
+
+/*
+ * walks the directories dirs and everything below them into a tree kept
+ * in memory, then answers the requests of clients on the Unix socket at
+ * path from it for as long as it runs. the tree is listed with flags,
+ * requests with other flags which change what is listed are answered
+ * from the file system. with inotify(7), the directories are read again
+ * as soon as they or their entries change, otherwise the times of every
+ * directory are checked every RESCAN_MS.
+ */
+void
+serve(const char *path, char *dirs[], int flags)
+{
+    int conn, lfd, n, npfd = 1, timeout = RESCAN_MS;
+    mode_t mask;
+    size_t i;
+    struct pollfd pfd[2];
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        (void)fprintf(stderr, "ls: %s: %s\n", path, strerror(ENAMETOOLONG));
+        exit(EXIT_FAILURE);
+    }
+    (void)strcpy(addr.sun_path, path);
+
+    if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        (void)fprintf(stderr, "ls: socket: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* only the user running the server may have it list for them */
+    (void)unlink(path);
+    mask = umask(077);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(lfd, SOMAXCONN) < 0) {
+        (void)fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    (void)umask(mask);
+
+    /* the processes answering requests are never waited for */
+    (void)signal(SIGCHLD, SIG_IGN);
+    (void)signal(SIGPIPE, SIG_IGN);
+
+    if (cache_mode == CACHE_OFF) {
+        cache_open(NULL, flags, 0);
+    }
+    roots = dirs;
+    tree_flags = flags;
+
+#ifdef SERVE_INOTIFY
+    if ((ifd = inotify_init1(IN_NONBLOCK)) < 0) {
+        (void)fprintf(stderr, "ls: inotify_init1: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    pfd[1].fd = ifd;
+    pfd[1].events = POLLIN;
+    npfd = 2;
+    timeout = -1;
+#endif
+    for (i = 0; roots[i] != NULL; i++) {
+        walk(roots[i], NULL);
+    }
+
+    pfd[0].fd = lfd;
+    pfd[0].events = POLLIN;
+    for (;;) {
+        if ((n = poll(pfd, npfd, timeout)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            (void)fprintf(stderr, "ls: poll: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+#ifdef SERVE_INOTIFY
+        if (pfd[1].revents & POLLIN) {
+            drain_events();
+        }
+#else
+        if (n == 0) {
+            for (i = 0; roots[i] != NULL; i++) {
+                walk(roots[i], NULL);
+            }
+        }
+#endif
+
+        if ((pfd[0].revents & POLLIN)
+            && (conn = accept(lfd, NULL, NULL)) >= 0) {
+#ifdef SERVE_INOTIFY
+            /* a change made right before the request is queued by now */
+            drain_events();
+#endif
+            answer(lfd, conn);
+            (void)close(conn);
+        }
+    }
+}
+
+/*
+ * has the server on the Unix socket at path list what the arguments ask
+ * for, exactly as if ls had been run with them here. returns the exit
+ * status, or -1 if there is no server to ask.
+ */
+int
+request(const char *path, int argc, char *argv[])
+{
+    char *args, status;
+    int cwd, fd, i, fds[3];
+    size_t len = 0, off;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    struct msghdr msg;
+    struct reqhdr hdr;
+    struct sockaddr_un addr;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctl;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    (void)strcpy(addr.sun_path, path);
+
+    for (i = 0; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    if (len > REQ_MAX) {
+        return -1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || (cwd = open(".", O_RDONLY | O_DIRECTORY)) < 0) {
+        (void)close(fd);
+        return -1;
+    }
+
+    if ((args = malloc(len)) == NULL) {
+        (void)fprintf(stderr, "ls: malloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0, off = 0; i < argc; i++) {
+        (void)strcpy(args + off, argv[i]);
+        off += strlen(argv[i]) + 1;
+    }
+
+    hdr.magic = REQ_MAGIC;
+    hdr.argc = (unsigned int)argc;
+    hdr.len = (unsigned int)len;
+    fds[0] = cwd;
+    fds[1] = STDOUT_FILENO;
+    fds[2] = STDERR_FILENO;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+
+    if (sendmsg(fd, &msg, 0) != (ssize_t)sizeof(hdr)
+        || write_all(fd, args, len) < 0) {
+        free(args);
+        (void)close(cwd);
+        (void)close(fd);
+        return -1;
+    }
+    free(args);
+    (void)close(cwd);
+
+    /* the server lists straight to our standard output, the status comes
+     * last, if the process answering dies there is none */
+    if (read_all(fd, &status, 1) < 0) {
+        status = EXIT_FAILURE;
+    }
+    (void)close(fd);
+    return status;
+}
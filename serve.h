@@ -0,0 +1,9 @@
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+extern int served;
+
+void serve(const char *, char *[], int);
+int request(const char *, int, char *[]);
+
+#endif
@@ -0,0 +1,461 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dirlist.h"
+#include "flags.h"
+#include "sort.h"
+#include "utils.h"
+
+/* flipping the sign bit makes signed keys sort as unsigned ones */
+#define SIGN_BIT (1ULL << 63)
+
+/* the number of 8 bit digits in a key, aux comes first */
+#define KEY_DIGITS 12
+
+/* below this many entries, an insertion sort beats clearing the counts */
+#define SORT_SMALL 32
+
+/*
+ * the packed sort key of an entry, compared as key first and aux second.
+ * idx is the position of the entry in the list before sorting, name is
+ * what ties are settled by, its collation key when sorting by name.
+ */
+struct sortkey {
+    unsigned long long key;
+    unsigned int aux;
+    size_t idx;
+    const char *name;
+};
+
+/* names are sorted by their collation keys, set by sort_init() */
+static int collate;
+
+/* the collation keys of a directory are packed into chunks of this size */
+#define COLLPOOL_SZ (64 * 1024)
+
+struct collchunk {
+    struct collchunk *prev;
+};
+
+/*
+ * the collation keys of the directory being sorted, the current chunk
+ * has left bytes free starting at next.
+ */
+struct collpool {
+    struct collchunk *chunks;
+    char *next;
+    size_t left;
+};
+
+/* a chunk of keys for a thread to sort, or two runs of keys to merge */
+struct sortjob {
+    struct sortkey *keys;
+    struct sortkey *tmp;
+    size_t n;
+    const struct sortkey *a;
+    const struct sortkey *b;
+    size_t na;
+    size_t nb;
+};
+
+/*
+ * packs the first 8 bytes of name so that comparing the keys gives the
+ * same order strcmp(3) does for them.
+ */
+static unsigned long long
+name_prefix(const char *name)
+{
+    unsigned long long key = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        key <<= 8;
+        if (*name != '\0') {
+            key |= (unsigned char)*name++;
+        }
+    }
+    return key;
+}
+
+/*
+ * decides whether names have to be sorted by their collation keys. in the
+ * C and POSIX locales, and C.UTF-8 which collates by code point, byte order
+ * is already the collation order.
+ */
+void
+sort_init(void)
+{
+    const char *locale = setlocale(LC_COLLATE, NULL);
+
+    collate = locale != NULL && strcmp(locale, "C") != 0
+        && strcmp(locale, "POSIX") != 0 && strncmp(locale, "C.", 2) != 0;
+}
+
+/*
+ * transforms name with strxfrm(3) into the pool, so that strcmp(3) on the
+ * result orders names like strcoll(3) would. name itself is the key if
+ * there is no room for it.
+ */
+static const char *
+coll_key(struct collpool *pool, const char *name)
+{
+    struct collchunk *chunk;
+    size_t len, size;
+    char *key;
+
+    len = strxfrm(pool->next, name, pool->left);
+    if (pool->chunks == NULL || len >= pool->left) {
+        size = len + 1 > COLLPOOL_SZ ? len + 1 : COLLPOOL_SZ;
+        if ((chunk = malloc(sizeof(*chunk) + size)) == NULL) {
+            fail("malloc");
+            return name;
+        }
+        chunk->prev = pool->chunks;
+        pool->chunks = chunk;
+        pool->next = (char *)(chunk + 1);
+        pool->left = size;
+        len = strxfrm(pool->next, name, pool->left);
+    }
+
+    key = pool->next;
+    pool->next += len + 1;
+    pool->left -= len + 1;
+    return key;
+}
+
+static void
+free_collpool(struct collpool *pool)
+{
+    struct collchunk *chunk;
+
+    while ((chunk = pool->chunks) != NULL) {
+        pool->chunks = chunk->prev;
+        free(chunk);
+    }
+}
+
+/*
+ * extracts the key of every entry, such that sorting the keys in ascending
+ * order gives the order get_compar() describes.
+ */
+static void
+extract_keys(const struct dirlist *list, struct sortkey *keys, int flags,
+    struct collpool *pool)
+{
+    const struct dirmeta *meta = &list->meta;
+    size_t i, idx;
+
+    for (i = 0; i < list->nents; i++) {
+        idx = list->ents[i].idx;
+        keys[i].idx = i;
+        keys[i].aux = 0;
+        keys[i].name = list->ents[i].name;
+
+        /* the time the flags select is the only one kept */
+        if (flags & FLAG_t) {
+            keys[i].key = (unsigned long long)meta->sec[idx] ^ SIGN_BIT;
+            keys[i].aux = (unsigned int)meta->nsec[idx];
+        } else if (flags & FLAG_S) {
+            keys[i].key = (unsigned long long)meta->size[idx] ^ SIGN_BIT;
+        } else {
+            if (collate) {
+                keys[i].name = coll_key(pool, keys[i].name);
+            }
+            keys[i].key = name_prefix(keys[i].name);
+        }
+
+        /* newest and largest first, unless -r is set */
+        if ((flags & (FLAG_t | FLAG_S)) && !(flags & FLAG_r)) {
+            keys[i].key = ~keys[i].key;
+            keys[i].aux = ~keys[i].aux;
+        }
+    }
+}
+
+static int
+key_less(const struct sortkey *a, const struct sortkey *b)
+{
+    return a->key < b->key || (a->key == b->key && a->aux < b->aux);
+}
+
+static unsigned int
+digit(const struct sortkey *k, int d)
+{
+    if (d < 4) {
+        return (k->aux >> (8 * d)) & 0xff;
+    }
+    return (unsigned int)(k->key >> (8 * (d - 4))) & 0xff;
+}
+
+/*
+ * sorts n keys with an LSD radix sort, using tmp as scratch space. digits
+ * which are the same for every key are skipped. the sort is stable.
+ */
+static void
+radix_sort(struct sortkey *keys, struct sortkey *tmp, size_t n)
+{
+    size_t count[KEY_DIGITS][256];
+    size_t i, j, sum, c;
+    struct sortkey *src = keys, *dst = tmp, *swap, k;
+    int d;
+
+    if (n < SORT_SMALL) {
+        for (i = 1; i < n; i++) {
+            k = keys[i];
+            for (j = i; j > 0 && key_less(&k, &keys[j - 1]); j--) {
+                keys[j] = keys[j - 1];
+            }
+            keys[j] = k;
+        }
+        return;
+    }
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+        for (d = 0; d < KEY_DIGITS; d++) {
+            count[d][digit(&keys[i], d)]++;
+        }
+    }
+
+    for (d = 0; d < KEY_DIGITS; d++) {
+        if (count[d][digit(&keys[0], d)] == n) {
+            continue;
+        }
+
+        for (i = sum = 0; i < 256; i++) {
+            c = count[d][i];
+            count[d][i] = sum;
+            sum += c;
+        }
+        for (i = 0; i < n; i++) {
+            dst[count[d][digit(&src[i], d)]++] = src[i];
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != keys) {
+        memcpy(keys, src, n * sizeof(*keys));
+    }
+}
+
+/*
+ * merges the sorted runs a and b into keys, an entry of a goes first when
+ * both are equal.
+ */
+static void
+merge(const struct sortkey *a, size_t na, const struct sortkey *b,
+    size_t nb, struct sortkey *keys)
+{
+    while (na > 0 && nb > 0) {
+        if (key_less(b, a)) {
+            *keys++ = *b++;
+            nb--;
+        } else {
+            *keys++ = *a++;
+            na--;
+        }
+    }
+    memcpy(keys, a, na * sizeof(*keys));
+    memcpy(keys + na, b, nb * sizeof(*keys));
+}
+
+static void *
+sort_worker(void *arg)
+{
+    struct sortjob *job = arg;
+
+    if (job->a != NULL) {
+        merge(job->a, job->na, job->b, job->nb, job->keys);
+    } else {
+        radix_sort(job->keys, job->tmp, job->n);
+    }
+    return NULL;
+}
+
+/*
+ * runs every job on a thread of its own, or in the calling thread if no
+ * thread can be created.
+ */
+static void
+run_jobs(struct sortjob *jobs, int njobs)
+{
+    pthread_t threads[SORT_MAX_THREADS];
+    int started[SORT_MAX_THREADS];
+    int i;
+
+    for (i = 0; i < njobs; i++) {
+        started[i] = pthread_create(&threads[i], NULL, sort_worker,
+            &jobs[i]) == 0;
+        if (!started[i]) {
+            (void)sort_worker(&jobs[i]);
+        }
+    }
+    for (i = 0; i < njobs; i++) {
+        if (started[i]) {
+            (void)pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+/*
+ * sorts a large number of keys by radix sorting one chunk per thread, then
+ * merging neighbouring runs pairwise, in parallel as well, until one is
+ * left. the result ends up in keys.
+ */
+static void
+parallel_sort(struct sortkey *keys, struct sortkey *tmp, size_t n,
+    int nthreads)
+{
+    struct sortjob jobs[SORT_MAX_THREADS];
+    size_t bounds[SORT_MAX_THREADS + 1];
+    struct sortkey *src = keys, *dst = tmp, *swap;
+    int i, nruns, njobs;
+
+    for (i = 0; i <= nthreads; i++) {
+        bounds[i] = n / nthreads * i + (n % nthreads) * i / nthreads;
+    }
+
+    memset(jobs, 0, sizeof(jobs));
+    for (i = 0; i < nthreads; i++) {
+        jobs[i].keys = keys + bounds[i];
+        jobs[i].tmp = tmp + bounds[i];
+        jobs[i].n = bounds[i + 1] - bounds[i];
+    }
+    run_jobs(jobs, nthreads);
+
+    for (nruns = nthreads; nruns > 1; nruns = (nruns + 1) / 2) {
+        memset(jobs, 0, sizeof(jobs));
+        for (i = njobs = 0; i + 1 < nruns; i += 2, njobs++) {
+            jobs[njobs].a = src + bounds[i];
+            jobs[njobs].na = bounds[i + 1] - bounds[i];
+            jobs[njobs].b = src + bounds[i + 1];
+            jobs[njobs].nb = bounds[i + 2] - bounds[i + 1];
+            jobs[njobs].keys = dst + bounds[i];
+        }
+        /* an odd run out is carried over as it is */
+        if (i < nruns) {
+            memcpy(dst + bounds[i], src + bounds[i],
+                (bounds[i + 1] - bounds[i]) * sizeof(*src));
+        }
+        run_jobs(jobs, njobs);
+
+        /* the merged runs now span two of the old bounds each */
+        for (i = 0; i <= (nruns + 1) / 2; i++) {
+            bounds[i] = bounds[2 * i < nruns ? 2 * i : nruns];
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != keys) {
+        memcpy(keys, src, n * sizeof(*keys));
+    }
+}
+
+static int
+key_ascending(const void *p1, const void *p2)
+{
+    return strcmp(((const struct sortkey *)p1)->name,
+        ((const struct sortkey *)p2)->name);
+}
+
+/* only runs of entries with the same time are ever compared by these, so
+ * they collate on the spot */
+static int
+coll_ascending(const void *p1, const void *p2)
+{
+    return strcoll(((const struct sortkey *)p1)->name,
+        ((const struct sortkey *)p2)->name);
+}
+
+static int
+coll_descending(const void *p1, const void *p2)
+{
+    return coll_ascending(p2, p1);
+}
+
+/*
+ * sorts the entries of list in the order the given flags ask for, which is
+ * the same order the comparators of cmp.c give. the entries need their
+ * metadata under -S and -t. they are left as they are if there is no room
+ * to sort them in.
+ */
+void
+sort_entries(struct dirlist *list, int flags)
+{
+    int (*tie)(const void *, const void *) = NULL;
+    int nthreads = 1;
+    long ncpu;
+    size_t n = list->nents, i, j;
+    struct collpool pool;
+    struct dirname *ents;
+    struct sortkey *keys, *tmp;
+
+    if (n < 2) {
+        return;
+    }
+
+    keys = malloc(n * sizeof(*keys));
+    tmp = malloc(n * sizeof(*tmp));
+    ents = malloc(n * sizeof(*ents));
+    if (keys == NULL || tmp == NULL || ents == NULL) {
+        fail("malloc");
+        free(keys);
+        free(tmp);
+        free(ents);
+        return;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    extract_keys(list, keys, flags, &pool);
+
+    if (n >= SORT_PAR_MIN && (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 1) {
+        nthreads = ncpu < SORT_MAX_THREADS ? (int)ncpu : SORT_MAX_THREADS;
+    }
+    if (nthreads > 1) {
+        parallel_sort(keys, tmp, n, nthreads);
+    } else {
+        radix_sort(keys, tmp, n);
+    }
+
+    /* the key only holds a prefix of the name, and entries with the same
+     * time are ordered by name, backwards unless -r is set. entries with the
+     * same size keep the order they were read in */
+    if (flags & FLAG_t) {
+        tie = (flags & FLAG_r) ? coll_ascending : coll_descending;
+    } else if (!(flags & FLAG_S)) {
+        tie = key_ascending;
+    }
+    if (tie != NULL) {
+        for (i = 0; i < n; i = j) {
+            for (j = i + 1; j < n && keys[j].key == keys[i].key
+                && keys[j].aux == keys[i].aux; j++) {
+                continue;
+            }
+            if (j - i > 1) {
+                qsort(keys + i, j - i, sizeof(*keys), tie);
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        ents[i] = list->ents[keys[i].idx];
+    }
+    memcpy(list->ents, ents, n * sizeof(*ents));
+
+    free_collpool(&pool);
+    free(keys);
+    free(tmp);
+    free(ents);
+}
@@ -0,0 +1,15 @@
+#ifndef _SORT_H_
+#define _SORT_H_
+
+#include "dirlist.h"
+
+/* directories with fewer entries are sorted by a single thread */
+#define SORT_PAR_MIN (128 * 1024)
+
+/* the most threads a single directory is sorted with */
+#define SORT_MAX_THREADS 8
+
+void sort_init(void);
+void sort_entries(struct dirlist *, int);
+
+#endif
@@ -0,0 +1,222 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* latencies are counted in power of two buckets of microseconds, the first
+ * one is for calls under 1us and the last one for those of 1s or more */
+#define NBUCKETS 22
+
+#define NSECS 1000000000LL
+
+/* set by --stats, nothing is measured otherwise */
+int stats_enabled;
+
+static const char *call_names[NCALLS] = {
+    "getdents", "stat", "open", "readlink", "write", "io_uring_enter",
+    "getpwuid/getgrgid"
+};
+
+static const char *phase_names[NPHASES] = {
+    "other", "readdir", "stat", "sort", "format", "write"
+};
+
+/* the counters are shared by every thread and only ever added to
+ * atomically */
+static unsigned long long calls[NCALLS];
+static unsigned long long latency[NCALLS][NBUCKETS];
+static unsigned long long phase_ns[NPHASES];
+static unsigned long long entries, bytes;
+
+static struct timespec started;
+
+/* the phase the calling thread is in and since when, a thread which has
+ * not entered one yet has a zero start */
+static __thread int cur_phase;
+static __thread struct timespec phase_start;
+
+static long long
+elapsed(const struct timespec *from, const struct timespec *to)
+{
+    long long ns;
+
+    ns = (long long)(to->tv_sec - from->tv_sec) * NSECS
+        + (to->tv_nsec - from->tv_nsec);
+    return ns < 0 ? 0 : ns;
+}
+
+static void
+add(unsigned long long *counter, unsigned long long n)
+{
+    (void)__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/*
+ * turns on --stats, the time of the run is measured from here.
+ */
+void
+stats_init(void)
+{
+    stats_enabled = 1;
+    stats_clock(&started);
+    phase_start = started;
+}
+
+void
+stats_clock(struct timespec *ts)
+{
+    (void)clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+/*
+ * counts a call of the given class which started at start, and how long it
+ * took.
+ */
+void
+stats_call(int call, const struct timespec *start)
+{
+    struct timespec now;
+    long long us;
+    int bucket;
+
+    stats_clock(&now);
+    us = elapsed(start, &now) / 1000;
+    for (bucket = 0; us > 0 && bucket < NBUCKETS - 1; bucket++) {
+        us >>= 1;
+    }
+
+    add(&calls[call], 1);
+    add(&latency[call][bucket], 1);
+}
+
+/*
+ * counts a call of the given class without timing it.
+ */
+void
+stats_count(int call)
+{
+    add(&calls[call], 1);
+}
+
+/*
+ * charges the time since the last switch to the phase the calling thread
+ * was in and moves it to phase. returns the phase it was in.
+ */
+static int
+switch_phase(int phase)
+{
+    struct timespec now;
+    int prev = cur_phase;
+
+    stats_clock(&now);
+    if (phase_start.tv_sec != 0 || phase_start.tv_nsec != 0) {
+        add(&phase_ns[prev], elapsed(&phase_start, &now));
+    }
+    cur_phase = phase;
+    phase_start = now;
+    return prev;
+}
+
+/*
+ * moves the calling thread into phase, returns the phase to go back to
+ * with stats_leave(). phases nest, time is only ever charged to the
+ * innermost one.
+ */
+int
+stats_enter(int phase)
+{
+    return switch_phase(phase);
+}
+
+void
+stats_leave(int prev)
+{
+    (void)switch_phase(prev);
+}
+
+void
+stats_entry(void)
+{
+    add(&entries, 1);
+}
+
+void
+stats_bytes(size_t n)
+{
+    add(&bytes, n);
+}
+
+static void
+print_ms(const char *name, long long ns)
+{
+    (void)fprintf(stderr, "  %-20s %12.3f\n", name, (double)ns / 1e6);
+}
+
+static void
+print_count(const char *name, unsigned long long n)
+{
+    (void)fprintf(stderr, "  %-20s %12lu\n", name, (unsigned long)n);
+}
+
+static void
+print_latency(int call)
+{
+    char label[32];
+    int bucket, header = 0;
+
+    for (bucket = 0; bucket < NBUCKETS; bucket++) {
+        if (latency[call][bucket] == 0) {
+            continue;
+        }
+        if (!header) {
+            (void)fprintf(stderr, "%s latency:\n", call_names[call]);
+            header = 1;
+        }
+        if (bucket == 0) {
+            (void)snprintf(label, sizeof(label), "< 1us");
+        } else if (bucket == NBUCKETS - 1) {
+            (void)snprintf(label, sizeof(label), ">= %luus",
+                1UL << (bucket - 1));
+        } else {
+            (void)snprintf(label, sizeof(label), "%lu-%luus",
+                1UL << (bucket - 1), 1UL << bucket);
+        }
+        print_count(label, latency[call][bucket]);
+    }
+}
+
+/*
+ * prints everything counted to standard error, once every other thread
+ * has finished. the time of the phases is summed over all threads, so
+ * under -P it may add up to more than the wall clock time.
+ */
+void
+stats_print(void)
+{
+    struct timespec now;
+    int i;
+
+    (void)switch_phase(cur_phase);
+    stats_clock(&now);
+
+    (void)fprintf(stderr, "calls:\n");
+    for (i = 0; i < NCALLS; i++) {
+        print_count(call_names[i], calls[i]);
+    }
+
+    (void)fprintf(stderr, "phases (ms):\n");
+    for (i = 0; i < NPHASES; i++) {
+        print_ms(phase_names[i], (long long)phase_ns[i]);
+    }
+    print_ms("wall", elapsed(&started, &now));
+
+    /* only the calls which were timed have a histogram */
+    for (i = 0; i < NCALLS; i++) {
+        print_latency(i);
+    }
+
+    (void)fprintf(stderr, "output:\n");
+    print_count("entries", entries);
+    print_count("bytes", bytes);
+}
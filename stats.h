@@ -0,0 +1,57 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stddef.h>
+#include <time.h>
+
+/* the classes of calls --stats counts */
+#define CALL_GETDENTS 0
+#define CALL_STAT 1
+#define CALL_OPEN 2
+#define CALL_READLINK 3
+#define CALL_WRITE 4
+#define CALL_URING 5
+#define CALL_NSS 6
+#define NCALLS 7
+
+/* the phases the run time is split into, time spent in none of them is
+ * counted as other */
+#define PHASE_OTHER 0
+#define PHASE_READDIR 1
+#define PHASE_STAT 2
+#define PHASE_SORT 3
+#define PHASE_FORMAT 4
+#define PHASE_WRITE 5
+#define NPHASES 6
+
+extern int stats_enabled;
+
+/*
+ * the macros below do nothing but test stats_enabled unless --stats was
+ * given, they are what the rest of ls uses.
+ */
+#define STATS_START(ts) \
+    do { if (stats_enabled) stats_clock(&(ts)); } while (0)
+#define STATS_CALL(call, ts) \
+    do { if (stats_enabled) stats_call((call), &(ts)); } while (0)
+#define STATS_COUNT(call) \
+    do { if (stats_enabled) stats_count((call)); } while (0)
+#define STATS_ENTER(phase) (stats_enabled ? stats_enter(phase) : PHASE_OTHER)
+#define STATS_LEAVE(phase) \
+    do { if (stats_enabled) stats_leave(phase); } while (0)
+#define STATS_ENTRY() \
+    do { if (stats_enabled) stats_entry(); } while (0)
+#define STATS_BYTES(n) \
+    do { if (stats_enabled) stats_bytes(n); } while (0)
+
+void stats_init(void);
+void stats_clock(struct timespec *);
+void stats_call(int, const struct timespec *);
+void stats_count(int);
+int stats_enter(int);
+void stats_leave(int);
+void stats_entry(void);
+void stats_bytes(size_t);
+void stats_print(void);
+
+#endif
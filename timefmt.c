@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timefmt.h"
+#include "utils.h"
+
+#define SECSPERMIN 60
+#define SECSPERDAY (24 * 60 * 60)
+
+/* how far from now the range a single UTC offset holds for is searched */
+#define RANGE_DAYS 400
+
+/* formatted times are cached per minute, a power of two of them */
+#define TIMECACHE_SZ 64
+
+/* "Jan 12 12:34" or "Jan 12  2024" and a NUL */
+#define TIMESTR_SZ 13
+
+static const char months[12][4] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/* the time of the run, and the range [range_lo, range_hi) around it in which
+ * local time is always offset seconds ahead of UTC */
+static time_t now, range_lo, range_hi;
+static long offset;
+static int have_range;
+
+/*
+ * a formatted time, bucket is the local minute it was formatted for, times
+ * for the year format are kept in odd buckets.
+ */
+struct timeslot {
+    long long bucket;
+    int used;
+    char str[TIMESTR_SZ];
+};
+
+/* every thread formatting times has its own cache */
+static __thread struct timeslot cache[TIMECACHE_SZ];
+
+static long long
+floor_div(long long a, long long b)
+{
+    return a / b - (a % b < 0);
+}
+
+/*
+ * returns the number of days between 1970-01-01 and the given date of the
+ * proleptic Gregorian calendar, month counting from 1.
+ */
+static long long
+days_from_civil(long long y, int m, int d)
+{
+    long long era, yoe, doy, doe;
+
+    y -= m <= 2;
+    era = floor_div(y, 400);
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/*
+ * the inverse of days_from_civil().
+ */
+static void
+civil_from_days(long long z, long long *y, int *m, int *d)
+{
+    long long era, doe, yoe, doy, mp;
+
+    z += 719468;
+    era = floor_div(z, 146097);
+    doe = z - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+/*
+ * finds how many seconds local time is ahead of UTC at t. returns -1 if t
+ * cannot be converted.
+ */
+static int
+utc_offset(time_t t, long *off)
+{
+    struct tm lt, gt;
+
+    if (localtime_r(&t, &lt) == NULL || gmtime_r(&t, &gt) == NULL) {
+        return -1;
+    }
+    *off = (long)(days_from_civil(lt.tm_year + 1900LL, lt.tm_mon + 1,
+        lt.tm_mday) - days_from_civil(gt.tm_year + 1900LL, gt.tm_mon + 1,
+        gt.tm_mday)) * SECSPERDAY
+        + (lt.tm_hour - gt.tm_hour) * 3600L
+        + (lt.tm_min - gt.tm_min) * 60L + (lt.tm_sec - gt.tm_sec);
+    return 0;
+}
+
+static int
+same_offset(time_t t)
+{
+    long off;
+
+    return utc_offset(t, &off) == 0 && off == offset;
+}
+
+/*
+ * walks away from now a day at a time, dir being 1 or -1, until the offset
+ * changes, and returns the last second it is still the same at.
+ */
+static time_t
+range_end(int dir)
+{
+    time_t same = now, other = now;
+    int i;
+
+    for (i = 0; i < RANGE_DAYS; i++) {
+        other = same + dir * SECSPERDAY;
+        if (!same_offset(other)) {
+            break;
+        }
+        same = other;
+    }
+    if (i == RANGE_DAYS) {
+        return same;
+    }
+
+    /* the transition is somewhere between the two, bisect to the second */
+    while (same - other > 1 || other - same > 1) {
+        if (same_offset(same + (other - same) / 2)) {
+            same = same + (other - same) / 2;
+        } else {
+            other = same + (other - same) / 2;
+        }
+    }
+    return same;
+}
+
+/*
+ * works out the UTC offset of the local time zone and the range around now
+ * it holds for, so most times can be formatted without localtime(3). has to
+ * be called before format_time(), and before any thread is started.
+ */
+void
+timefmt_init(void)
+{
+    now = time(NULL);
+
+    if (utc_offset(now, &offset) < 0) {
+        return;
+    }
+    range_lo = range_end(-1);
+    range_hi = range_end(1) + 1;
+    have_range = 1;
+}
+
+/*
+ * formats t with localtime(3) and strftime(3), for times outside the
+ * range timefmt_init() found.
+ */
+static void
+format_slow(time_t t, int recent, char *buf)
+{
+    struct tm tm;
+    size_t n;
+
+    if (localtime_r(&t, &tm) == NULL) {
+        memset(&tm, 0, sizeof(tm));
+    }
+
+    if (strftime(buf, TIMESTR_SZ, recent ? "%b %e %H:%M" : "%b %e  %Y",
+        &tm) == 0) {
+        n = strlcpy(buf, "???", TIMESTR_SZ);
+        if (n >= TIMESTR_SZ) {
+            fail("strlcpy");
+        }
+    }
+}
+
+static void
+put2(char *p, int n, char pad)
+{
+    p[0] = n >= 10 ? '0' + n / 10 : pad;
+    p[1] = '0' + n % 10;
+}
+
+/*
+ * returns t formatted for a long listing: the date and time for files
+ * modified within six months of now, the date and year for others. the
+ * string is valid until the next call from the same thread.
+ */
+const char *
+format_time(time_t t)
+{
+    int recent = t + SIXMONTHS > now && t - SIXMONTHS < now;
+    int m, d, secs;
+    long long local, days, bucket, y;
+    struct timeslot *slot;
+    static __thread char buf[TIMESTR_SZ];
+
+    if (!have_range || t < range_lo || t >= range_hi) {
+        format_slow(t, recent, buf);
+        return buf;
+    }
+
+    local = (long long)t + offset;
+    bucket = floor_div(local, SECSPERMIN) * 2 + !recent;
+    slot = &cache[(unsigned long long)bucket & (TIMECACHE_SZ - 1)];
+    if (slot->used && slot->bucket == bucket) {
+        return slot->str;
+    }
+
+    days = floor_div(local, SECSPERDAY);
+    secs = (int)(local - days * SECSPERDAY);
+    civil_from_days(days, &y, &m, &d);
+
+    /* "%b %e %H:%M" or "%b %e  %Y", month names are those of the C locale
+     * since LC_TIME is never set */
+    memcpy(slot->str, months[m - 1], 3);
+    slot->str[3] = ' ';
+    put2(slot->str + 4, d, ' ');
+    slot->str[6] = ' ';
+    if (recent) {
+        put2(slot->str + 7, secs / 3600, '0');
+        slot->str[9] = ':';
+        put2(slot->str + 10, secs / 60 % 60, '0');
+    } else {
+        slot->str[7] = ' ';
+        put2(slot->str + 8, (int)(y / 100), '0');
+        put2(slot->str + 10, (int)(y % 100), '0');
+    }
+    slot->str[12] = '\0';
+    slot->bucket = bucket;
+    slot->used = 1;
+    return slot->str;
+}
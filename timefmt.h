@@ -0,0 +1,12 @@
+#ifndef _TIMEFMT_H_
+#define _TIMEFMT_H_
+
+#include <time.h>
+
+/* files this much older or newer than now show their year, not their time */
+#define SIXMONTHS ((365 / 2) * 24 * 60 * 60)
+
+void timefmt_init(void);
+const char *format_time(time_t);
+
+#endif
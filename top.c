@@ -0,0 +1,247 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flags.h"
+#include "print.h"
+#include "top.h"
+#include "utils.h"
+
+/* the heap starts out with room for this many entries and doubles */
+#define TOP_INIT_SZ 64
+
+/*
+ * an entry kept by --top. under -R name is its whole path and base the
+ * last component of it, which is what entries are ordered by. seq is the
+ * order in which the entries were offered.
+ */
+struct topent {
+    char *name;
+    const char *base;
+    struct stat sb;
+    unsigned long long seq;
+};
+
+/*
+ * the first max entries offered so far, as a heap with the one which
+ * comes last at its root. it is emptied after every directory, unless -R
+ * is set, in which case it holds the first entries of the whole tree.
+ */
+static struct topent *heap;
+static size_t nheap, heapcap, max;
+static unsigned long long seq;
+static int top_flags;
+
+/*
+ * keeps the first n entries of what is listed, in the order of flags.
+ */
+void
+top_init(size_t n, int flags)
+{
+    max = n;
+    top_flags = flags;
+}
+
+static void
+entry_time(const struct stat *sb, time_t *sec, long *nsec)
+{
+    if (top_flags & FLAG_u) {
+        *sec = sb->st_atime;
+        *nsec = ST_ATIMENSEC(sb);
+    } else if (top_flags & FLAG_c) {
+        *sec = sb->st_ctime;
+        *nsec = ST_CTIMENSEC(sb);
+    } else {
+        *sec = sb->st_mtime;
+        *nsec = ST_MTIMENSEC(sb);
+    }
+}
+
+/*
+ * compares two entries in the order sort_entries() lists them in, which
+ * under -f without -S or -t is the order they were read in. returns less
+ * than zero if a comes first.
+ */
+static int
+compare(const struct topent *a, const struct topent *b)
+{
+    time_t asec, bsec;
+    long ansec, bnsec;
+    int rv = 0;
+
+    if (top_flags & FLAG_t) {
+        /* newest first, the same times backwards by name */
+        entry_time(&a->sb, &asec, &ansec);
+        entry_time(&b->sb, &bsec, &bnsec);
+        if (asec != bsec) {
+            rv = asec > bsec ? -1 : 1;
+        } else if (ansec != bnsec) {
+            rv = ansec > bnsec ? -1 : 1;
+        } else {
+            rv = strcoll(b->base, a->base);
+        }
+        return (top_flags & FLAG_r) ? -rv : rv;
+    } else if (top_flags & FLAG_S) {
+        /* largest first, the same sizes in the order they were read */
+        if (a->sb.st_size != b->sb.st_size) {
+            rv = a->sb.st_size > b->sb.st_size ? -1 : 1;
+            return (top_flags & FLAG_r) ? -rv : rv;
+        }
+    } else if (!(top_flags & FLAG_f)) {
+        rv = strcoll(a->base, b->base);
+    }
+
+    if (rv == 0 && a->seq != b->seq) {
+        rv = a->seq < b->seq ? -1 : 1;
+    }
+    return rv;
+}
+
+static void
+swap(size_t i, size_t j)
+{
+    struct topent tmp = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+/*
+ * moves the entry at i down the first n entries of the heap until
+ * neither of its children comes after it.
+ */
+static void
+sift_down(size_t i, size_t n)
+{
+    size_t child;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && compare(&heap[child + 1], &heap[child]) > 0) {
+            child++;
+        }
+        if (compare(&heap[child], &heap[i]) <= 0) {
+            break;
+        }
+        swap(i, child);
+        i = child;
+    }
+}
+
+static void
+sift_up(size_t i)
+{
+    size_t parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (compare(&heap[i], &heap[parent]) <= 0) {
+            break;
+        }
+        swap(i, parent);
+        i = parent;
+    }
+}
+
+/*
+ * offers the entry name of the directory path. it is kept if fewer than
+ * max entries have been kept or it comes before the last of them, which
+ * is then dropped. nothing is copied for an entry which is not kept, nor
+ * for one there is no room for.
+ */
+void
+top_offer(const char *path, const char *name, const struct stat *sb)
+{
+    struct topent ent, *grown;
+    size_t cap;
+    char *kept;
+
+    ent.base = name;
+    ent.sb = *sb;
+    ent.seq = seq++;
+
+    if (nheap == max && compare(&ent, &heap[0]) >= 0) {
+        return;
+    }
+
+    if (top_flags & FLAG_R) {
+        if ((kept = make_path(path, name)) == NULL) {
+            return;
+        }
+        ent.base = kept + strlen(kept) - strlen(name);
+    } else if ((kept = strdup(name)) == NULL) {
+        fail("strdup");
+        return;
+    } else {
+        ent.base = kept;
+    }
+    ent.name = kept;
+
+    if (nheap == max) {
+        free(heap[0].name);
+        heap[0] = ent;
+        sift_down(0, nheap);
+        return;
+    }
+
+    if (nheap == heapcap) {
+        cap = heapcap ? heapcap * 2 : TOP_INIT_SZ;
+        if (cap > max) {
+            cap = max;
+        }
+        if ((grown = realloc(heap, cap * sizeof(*heap))) == NULL) {
+            fail("realloc");
+            free(kept);
+            return;
+        }
+        heap = grown;
+        heapcap = cap;
+    }
+    heap[nheap] = ent;
+    sift_up(nheap++);
+}
+
+/*
+ * prints the entries kept, in order, and empties the heap. without -R
+ * they are entries of the directory path, open as fd. under -R each
+ * carries its own path, by which it is also read from.
+ */
+void
+top_print(int fd, const char *path)
+{
+    size_t i;
+
+    /* the last entry is taken off the root first, then the one before */
+    for (i = nheap; i > 1; i--) {
+        swap(0, i - 1);
+        sift_down(0, i - 1);
+    }
+
+    for (i = 0; i < nheap; i++) {
+        if (top_flags & FLAG_R) {
+            print_file(AT_FDCWD, heap[i].name, NULL, &heap[i].sb);
+        } else {
+            print_file(fd, heap[i].name, path, &heap[i].sb);
+        }
+        free(heap[i].name);
+    }
+    nheap = 0;
+    seq = 0;
+}
+
+void
+free_top(void)
+{
+    size_t i;
+
+    for (i = 0; i < nheap; i++) {
+        free(heap[i].name);
+    }
+    free(heap);
+    heap = NULL;
+    nheap = heapcap = 0;
+}
@@ -0,0 +1,16 @@
+#ifndef _TOP_H_
+#define _TOP_H_
+
+#include <sys/stat.h>
+
+#include <stddef.h>
+
+/* the most entries --top is allowed to keep */
+#define MAX_TOP 100000000
+
+void top_init(size_t, int);
+void top_offer(const char *, const char *, const struct stat *);
+void top_print(int, const char *);
+void free_top(void);
+
+#endif
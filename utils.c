@@ -1,6 +1,5 @@
 #include <errno.h>
-#include <dirent.h>
-#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,112 +8,114 @@
 #include "utils.h"
 
 /*
- * checks whether a file is hidden or not.
- * return values:
- *  - 1: file is hidden
- *  - 0: file is not hidden
+ * whether fail() ends the listing rather than the process, and the errno
+ * of the first failure since fail_return() was called.
  */
-int
-is_hidden(const char *filename)
+static int fail_soft;
+static int fail_errno;
+static pthread_mutex_t fail_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * has fail() end the listing instead of exiting if soft is set, which is
+ * how liblsdir returns its failures, and forgets any earlier failure. it
+ * has to be called before any thread of a listing is started.
+ */
+void
+fail_return(int soft)
 {
-    if (filename[0] == '.') {
-        return 1;
-    }
-    return 0;
+    fail_soft = soft;
+    fail_errno = 0;
 }
 
 /*
- * calculates the total number of blocks a directory takes
+ * reports that what failed with errno. ls exits. a listing made through
+ * the library keeps the error for lsdir_print() or lsdir_walk() to return
+ * instead, and the caller drops what it was doing and carries on with
+ * the rest of the listing.
  */
-blkcnt_t
-get_dir_blk_size(const char *dir, int flags)
+void
+fail(const char *what)
 {
-    blkcnt_t total = 0;
-    char path[PATH_MAX];
-    DIR *dp;
-    long blk_size, proportion;
-    struct stat info;
-    struct dirent *entry;
-
-    (void)getbsize(NULL, &blk_size);
+    int err = errno;
 
-    if ((dp = opendir(dir)) == NULL) {
-        return -1;
+    if (!fail_soft) {
+        (void)fprintf(stderr, "ls: %s: %s\n", what, strerror(err));
+        exit(EXIT_FAILURE);
     }
- 
-    while ((entry = readdir(dp))) {
-        /* only count hidden files if -A or -a is set
-         * and only count "." and ".." if -a is set */
-        if (!(flags & FLAG_a) && (strcmp(entry->d_name, ".") == 0 
-            || strcmp(entry->d_name, "..") == 0)) {
-                continue;
-        } else if (!(flags & (FLAG_a | FLAG_A)) && is_hidden(entry->d_name)) {
-            continue;
-        }
-        
-        /* construct the full path to the subdir */
-        if (dir[strlen(dir)-1] != '/') {
-            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
-        } else {
-            snprintf(path, sizeof(path), "%s%s", dir, entry->d_name);
-        }
 
-        if (lstat(path, &info) < 0) {
-            (void)fprintf(stderr, "ls: lstat: %s: %s\n", path, strerror(errno));
-            continue;
-        }
-
-        /* if -h is set, we only care about the actual size to be humanized */
-        if (flags & FLAG_h) {
-            total += info.st_size;
-        } else {
-            total += info.st_blocks;
-        }
+    (void)pthread_mutex_lock(&fail_lock);
+    if (fail_errno == 0) {
+        fail_errno = err;
     }
+    (void)pthread_mutex_unlock(&fail_lock);
+}
 
-    if (closedir(dp) < 0) {
-        (void)fprintf(stderr, "ls: closedir: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
-    }
+/*
+ * returns the errno of the first failure of the listing, or 0 if nothing
+ * has failed.
+ */
+int
+failed(void)
+{
+    int err;
 
-    /* total is in the unit of 512 byte blocks, which is half a KB */
-    if (flags & FLAG_k) {
-        return total / 2;
+    if (!fail_soft) {
+        return 0;
     }
+    (void)pthread_mutex_lock(&fail_lock);
+    err = fail_errno;
+    (void)pthread_mutex_unlock(&fail_lock);
+    return err;
+}
 
-    if (flags & FLAG_h) {
-        return total;
+/*
+ * checks whether a file is hidden or not.
+ * return values:
+ *  - 1: file is hidden
+ *  - 0: file is not hidden
+ */
+int
+is_hidden(const char *filename)
+{
+    if (filename[0] == '.') {
+        return 1;
     }
+    return 0;
+}
 
-    /* total is in the form of 512 byte blocks, we can the number of BLOCKSIZE
-     * blocks by first finding how many 512 byte blocks go into BLOCKSIZE, and
-     * then dividing that by the total */
-    proportion = blk_size / STAT_BLK_SIZE;
-
-    /* this handles the rounding since it doesn't makes sense to have portions
-     * of a block */
-    return (total + (proportion - 1)) / proportion;
+/*
+ * checks whether a file name is "." or "..".
+ */
+int
+is_dots(const char *filename)
+{
+    return filename[0] == '.' && (filename[1] == '\0'
+        || (filename[1] == '.' && filename[2] == '\0'));
 }
 
-/* 
- * finds the number of blocks a file takes up based on the env variable 
- * BLOCKSIZE
+/*
+ * builds the path of name inside the directory parent the same way fts(3)
+ * does, a single trailing slash of parent is not doubled. the result has to
+ * be freed by the caller. returns NULL if it cannot be allocated.
  */
-long
-get_file_blk_size(const struct stat *sb)
+char *
+make_path(const char *parent, const char *name)
 {
-    long blk_size;
-    long proportion;
-    (void)getbsize(NULL, &blk_size);
+    char *path;
+    size_t plen = strlen(parent), nlen = strlen(name);
 
-    /* total is in the form of 512 byte blocks, we can the number of BLOCKSIZE
-     * blocks by first finding how many 512 byte blocks go into BLOCKSIZE, and
-     * then dividing that by the total */
-    proportion = blk_size / STAT_BLK_SIZE;
+    if (plen > 0 && parent[plen - 1] == '/') {
+        plen--;
+    }
 
-    /* this handles the rounding since it doesn't makes sense to have portions
-     * of a block */
-    return (sb->st_blocks + (proportion - 1)) / proportion;
+    if ((path = malloc(plen + nlen + 2)) == NULL) {
+        fail("malloc");
+        return NULL;
+    }
+    memcpy(path, parent, plen);
+    path[plen] = '/';
+    memcpy(path + plen + 1, name, nlen + 1);
+    return path;
 }
 
 /*char *
@@ -1,14 +1,31 @@
 #ifndef _SIZE_H_
 #define _SIZE_H_
 
+#include <sys/types.h>
 #include <sys/stat.h>
 
 /* the "st_blocks" field in the stat struct is in 512 byte units which will
  * be used to calculate the number of blocks based on BLOCKSIZE */
 #define STAT_BLK_SIZE 512 
 
-blkcnt_t get_dir_blk_size(const char *, int);
-long get_file_blk_size(const struct stat *);
+/* the nanoseconds of the times in a stat struct. NetBSD has fields of their
+ * own for them, Linux keeps each time in a timespec wherever it defines
+ * st_atime on top of one */
+#if defined(__linux__) && defined(st_atime)
+#define ST_ATIMENSEC(sb) ((sb)->st_atim.tv_nsec)
+#define ST_MTIMENSEC(sb) ((sb)->st_mtim.tv_nsec)
+#define ST_CTIMENSEC(sb) ((sb)->st_ctim.tv_nsec)
+#else
+#define ST_ATIMENSEC(sb) ((sb)->st_atimensec)
+#define ST_MTIMENSEC(sb) ((sb)->st_mtimensec)
+#define ST_CTIMENSEC(sb) ((sb)->st_ctimensec)
+#endif
+
+void fail_return(int);
+void fail(const char *);
+int failed(void);
 int is_hidden(const char *);
+int is_dots(const char *);
+char *make_path(const char *, const char *);
 
 #endif